@@ -0,0 +1,392 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// misc
+#define ARGS_LIMIT 16
+#define RUNS_DEFAULT 5
+#define INPUT_DEFAULT (8<<20)
+static void usage(const char* name);
+static const char* sys_msg();
+static void err_msg(const char* fmt, ...);
+
+// workload
+typedef struct result_t {
+  const char* name;
+  int runs;
+  double median;
+  double best;
+  unsigned long long insns;
+  long rss;
+  int status;
+} result_t;
+static const char* g_args[ARGS_LIMIT];
+static int g_nargs;
+static int g_jit;
+static int jitted();
+static int mkinput(const size_t size);
+static int launch(char* const argv[], const int input, int* status, struct rusage* usage);
+static int measure(const char* dfalse, const char* file, const int input, const int runs, result_t* result);
+static int count(const char* dfalse, const char* file, const int input, unsigned long long* insns);
+static int dblcmp(const void* lhs, const void* rhs);
+static void report(const char* dfalse, const int runs, const result_t* results, const int size);
+static void jstring(const char* data);
+
+int main(int argc, char* argv[])
+{
+  int runs = RUNS_DEFAULT;
+  size_t size = INPUT_DEFAULT;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:a:h")) != -1)
+    switch (opt) {
+      case 'n': {
+        runs = atoi(optarg);
+        if (runs <= 0) {
+          err_msg("invalid run count %s", optarg);
+          goto err_0;
+        }
+        break;
+      }
+      case 's': {
+        char* end;
+        size = strtoul(optarg, &end, 10);
+        if (*end) {
+          err_msg("invalid input size %s", optarg);
+          goto err_0;
+        }
+        break;
+      }
+      case 'a': {
+        if (g_nargs == ARGS_LIMIT) {
+          err_msg("too many arguments for dfalse");
+          goto err_0;
+        }
+        g_args[g_nargs++] = optarg;
+        break;
+      }
+      case 'h': {
+        usage(argv[0]);
+        return 0;
+      }
+      default: {
+        usage(argv[0]);
+        goto err_0;
+      }
+    }
+
+  if (argc-optind < 2) {
+    usage(argv[0]);
+    goto err_0;
+  }
+
+  const char* dfalse = argv[optind++];
+  g_jit = jitted();
+  int input = mkinput(size);
+  if (input < 0) {
+    err_msg("make input failed");
+    goto err_0;
+  }
+
+  result_t* results = calloc(argc-optind, sizeof(result_t));
+  if (results == NULL) {
+    err_msg(sys_msg());
+    goto err_1;
+  }
+
+  int failed = 0;
+  int nresults = 0;
+  for (int i = optind; i < argc; i++) {
+    result_t* result = results+nresults++;
+    if (measure(dfalse, argv[i], input, runs, result) != 0) {
+      err_msg("measure %s failed", argv[i]);
+      goto err_2;
+    }
+    failed |= result->status != 0;
+  }
+
+  report(dfalse, runs, results, nresults);
+  free(results);
+  close(input);
+  return failed? -1: 0;
+err_2:
+  free(results);
+err_1:
+  close(input);
+err_0:
+  return -1;
+}
+
+static void usage(const char* name)
+{
+  fprintf(stderr,
+      "usage: %s [options] <dfalse> <bench.df>...\n"
+      "  -n RUNS   time every workload RUNS times (default %d)\n"
+      "  -s BYTES  feed BYTES of generated text to stdin (default %d)\n"
+      "  -a ARG    pass ARG to dfalse, may be repeated\n"
+      "  -h        show this message\n",
+      name, RUNS_DEFAULT, INPUT_DEFAULT);
+}
+
+static const char* sys_msg()
+{
+  return strerror(errno);
+}
+
+static void err_msg(const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "\e[31m");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\e[0m\n");
+  va_end(ap);
+}
+
+// every workload reads the same unlinked file, rewound before each run
+static int mkinput(const size_t size)
+{
+  char name[] = "/tmp/dfalse-bench-XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    err_msg("%s: %s", name, sys_msg());
+    goto err_0;
+  }
+  unlink(name);
+
+  static const char line[] = "the quick brown fox jumps over the lazy dog\n";
+  char buf[BUFSIZ];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = line[i%(sizeof(line)-1)];
+
+  for (size_t left = size; left > 0; ) {
+    size_t chunk = left < sizeof(buf)? left: sizeof(buf);
+    ssize_t n = write(fd, buf, chunk);
+    if (n < 0) {
+      err_msg(sys_msg());
+      goto err_1;
+    }
+    left -= n;
+  }
+  return fd;
+err_1:
+  close(fd);
+err_0:
+  return -1;
+}
+
+static int launch(char* const argv[], const int input, int* status, struct rusage* usage)
+{
+  if (lseek(input, 0, SEEK_SET) < 0) {
+    err_msg(sys_msg());
+    goto err_0;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    err_msg(sys_msg());
+    goto err_0;
+  }
+
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null < 0 || dup2(input, STDIN_FILENO) < 0 || dup2(null, STDOUT_FILENO) < 0)
+      _exit(127);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  int wstatus;
+  while (wait4(pid, &wstatus, 0, usage) < 0)
+    if (errno != EINTR) {
+      err_msg(sys_msg());
+      goto err_0;
+    }
+
+  *status = WIFEXITED(wstatus)? WEXITSTATUS(wstatus): 128+WTERMSIG(wstatus);
+  return 0;
+err_0:
+  return -1;
+}
+
+static int measure(const char* dfalse, const char* file, const int input, const int runs, result_t* result)
+{
+  const char* base = strrchr(file, '/');
+  result->name = base? base+1: file;
+
+  if (!g_jit && count(dfalse, file, input, &result->insns) != 0)
+    goto err_0;
+
+  double* times = calloc(runs, sizeof(double));
+  if (times == NULL) {
+    err_msg(sys_msg());
+    goto err_0;
+  }
+
+  char* argv[ARGS_LIMIT+3];
+  int argc = 0;
+  argv[argc++] = (char*)dfalse;
+  for (int i = 0; i < g_nargs; i++)
+    argv[argc++] = (char*)g_args[i];
+  argv[argc++] = (char*)file;
+  argv[argc] = NULL;
+
+  for (int i = 0; i < runs; i++) {
+    struct timespec start, stop;
+    struct rusage usage;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (launch(argv, input, &result->status, &usage) != 0)
+      goto err_1;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (usage.ru_maxrss > result->rss)
+      result->rss = usage.ru_maxrss;
+    if (result->status != 0) {
+      err_msg("%s exited with %d", file, result->status);
+      break;
+    }
+    times[result->runs++] = (stop.tv_sec-start.tv_sec)+(stop.tv_nsec-start.tv_nsec)/1e9;
+  }
+
+  // a failed run ends the timing, the rest come from the runs that finished
+  int done = result->runs;
+  if (done > 0) {
+    qsort(times, done, sizeof(double), dblcmp);
+    result->best = times[0];
+    result->median = done%2? times[done/2]: (times[done/2-1]+times[done/2])/2;
+  }
+  free(times);
+  return 0;
+err_1:
+  free(times);
+err_0:
+  return -1;
+}
+
+// the profiled run never takes the jit, its count says nothing about a jit run
+static int jitted()
+{
+  for (int i = 0; i < g_nargs; i++) {
+    const char* arg = g_args[i];
+    if (strcmp(arg, "--jit") == 0)
+      return 1;
+    if (arg[0] != '-' || arg[1] == '-')
+      continue;
+    // a short option cluster ends at the first option that takes a value
+    for (const char* it = arg+1; *it && strchr("ritpTDCm", *it) == NULL; it++)
+      if (*it == 'j')
+        return 1;
+  }
+  return 0;
+}
+
+// one untimed run under --profile, its report opens with the instruction count
+static int count(const char* dfalse, const char* file, const int input, unsigned long long* insns)
+{
+  char name[] = "/tmp/dfalse-profile-XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    err_msg("%s: %s", name, sys_msg());
+    goto err_0;
+  }
+
+  char option[sizeof(name)+sizeof("--profile=")];
+  sprintf(option, "--profile=%s", name);
+  char* argv[ARGS_LIMIT+4];
+  int argc = 0;
+  argv[argc++] = (char*)dfalse;
+  for (int i = 0; i < g_nargs; i++)
+    argv[argc++] = (char*)g_args[i];
+  argv[argc++] = option;
+  argv[argc++] = (char*)file;
+  argv[argc] = NULL;
+
+  int status;
+  struct rusage usage;
+  if (launch(argv, input, &status, &usage) != 0)
+    goto err_1;
+
+  FILE* report = fdopen(fd, "r");
+  if (report == NULL) {
+    err_msg(sys_msg());
+    goto err_1;
+  }
+
+  *insns = 0;
+  if (fscanf(report, "%llu instructions", insns) != 1)
+    err_msg("%s: no profile report", file);
+  fclose(report);
+  unlink(name);
+  return 0;
+err_1:
+  close(fd);
+  unlink(name);
+err_0:
+  return -1;
+}
+
+static int dblcmp(const void* lhs, const void* rhs)
+{
+  double l = *(const double*)lhs;
+  double r = *(const double*)rhs;
+  return l < r? -1: l > r? 1: 0;
+}
+
+static void report(const char* dfalse, const int runs, const result_t* results, const int size)
+{
+  printf("{\n");
+  printf("  \"dfalse\": ");
+  jstring(dfalse);
+  printf(",\n");
+  printf("  \"args\": [");
+  for (int i = 0; i < g_nargs; i++) {
+    printf("%s", i? ", ": "");
+    jstring(g_args[i]);
+  }
+  printf("],\n");
+  printf("  \"runs\": %d,\n", runs);
+  printf("  \"benchmarks\": [\n");
+  for (int i = 0; i < size; i++) {
+    const result_t* result = results+i;
+    printf("    {\"name\": ");
+    jstring(result->name);
+    printf(", \"status\": %d, \"runs\": %d, ", result->status, result->runs);
+    if (result->runs == 0)
+      printf("\"median_s\": null, \"best_s\": null, ");
+    else
+      printf("\"median_s\": %.6f, \"best_s\": %.6f, ", result->median, result->best);
+    if (!g_jit)
+      printf("\"instructions\": %llu, \"ops_per_s\": %.0f, ",
+          result->insns,
+          result->median > 0? result->insns/result->median: 0.0);
+    printf("\"peak_rss_kb\": %ld}%s\n",
+        result->rss,
+        i+1 < size? ",": "");
+  }
+  printf("  ]\n");
+  printf("}\n");
+}
+
+static void jstring(const char* data)
+{
+  putchar('"');
+  for (const unsigned char* it = (const unsigned char*)data; *it; it++)
+    if (*it == '"' || *it == '\\')
+      printf("\\%c", *it);
+    else if (*it < 0x20)
+      printf("\\u%04x", *it);
+    else
+      putchar(*it);
+  putchar('"');
+}
@@ -0,0 +1,571 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "vm.h"
+
+// runtime
+static const char* g_runtime =
+  "#include <stdlib.h>\n"
+  "#include <stdio.h>\n"
+  "\n"
+  "enum { VARADR_TYPE, VALUE_TYPE, CODE_TYPE, UNDEFINE_TYPE };\n"
+  "typedef struct df_cell_t { int type; df_value_t value; } df_cell_t;\n"
+  "static df_cell_t* df_data;\n"
+  "static size_t df_size;\n"
+  "static size_t df_capacity;\n"
+  "static df_cell_t df_vars[26] = {\n"
+  "  {VALUE_TYPE, 0},\n"
+  "#define DF_UNDEFINE {UNDEFINE_TYPE, 0}\n"
+  "  DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE,\n"
+  "  DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE,\n"
+  "  DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE,\n"
+  "  DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE,\n"
+  "  DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE, DF_UNDEFINE\n"
+  "#undef DF_UNDEFINE\n"
+  "};\n"
+  "static df_value_t df_memory[DF_MEMORY? DF_MEMORY: 1];\n"
+  "static const char* df_types[] = {\"varadr\", \"value\", \"function\", \"__TYPE_UNDEFINE__\"};\n"
+  "enum { DF_CALL, DF_COND, DF_BODY };\n"
+  "typedef struct df_frame_t { int type; int ret; int cond; int body; } df_frame_t;\n"
+  "static df_frame_t* df_frames;\n"
+  "static size_t df_depth;\n"
+  "static size_t df_frames_capacity;\n"
+  "\n"
+  "static void df_fail(const char* msg)\n"
+  "{\n"
+  "  fflush(stdout);\n"
+  "  fprintf(stderr, \"%s\\n\", msg);\n"
+  "  exit(EXIT_FAILURE);\n"
+  "}\n"
+  "\n"
+  "static inline void df_push(int type, df_value_t value)\n"
+  "{\n"
+  "  if (df_size == df_capacity) {\n"
+  "    df_capacity = df_capacity? df_capacity*2: BUFSIZ;\n"
+  "    df_data = realloc(df_data, df_capacity*sizeof(df_cell_t));\n"
+  "    if (df_data == NULL)\n"
+  "      df_fail(\"out of memory\");\n"
+  "  }\n"
+  "  df_data[df_size].type = type;\n"
+  "  df_data[df_size++].value = value;\n"
+  "}\n"
+  "\n"
+  "static inline df_cell_t df_pop(void)\n"
+  "{\n"
+  "  if (df_size == 0)\n"
+  "    df_fail(\"stack underflow\");\n"
+  "  return df_data[--df_size];\n"
+  "}\n"
+  "\n"
+  "static inline df_value_t df_expect(df_cell_t cell, int type)\n"
+  "{\n"
+  "  if (cell.type != type) {\n"
+  "    fflush(stdout);\n"
+  "    fprintf(stderr, \"expect %s not %s\\n\", df_types[type], df_types[cell.type]);\n"
+  "    exit(EXIT_FAILURE);\n"
+  "  }\n"
+  "  return cell.value;\n"
+  "}\n"
+  "\n"
+  "static inline df_value_t df_pop_type(int type)\n"
+  "{\n"
+  "  return df_expect(df_pop(), type);\n"
+  "}\n"
+  "\n"
+  "static inline void df_overflow(int overflow)\n"
+  "{\n"
+  "  if (overflow && DF_TRAP)\n"
+  "    df_fail(\"arithmetic overflow\");\n"
+  "}\n"
+  "\n"
+  "static inline void df_binary(int op)\n"
+  "{\n"
+  "  df_value_t rhs = df_pop_type(VALUE_TYPE);\n"
+  "  df_value_t lhs = df_pop_type(VALUE_TYPE);\n"
+  "  switch (op) {\n"
+  "    case '+': df_overflow(__builtin_add_overflow(lhs, rhs, &lhs)); break;\n"
+  "    case '-': df_overflow(__builtin_sub_overflow(lhs, rhs, &lhs)); break;\n"
+  "    case '*': df_overflow(__builtin_mul_overflow(lhs, rhs, &lhs)); break;\n"
+  "    case '/':\n"
+  "      if (rhs == 0)\n"
+  "        df_fail(\"attempt to divide 0\");\n"
+  "      if (rhs == -1)\n"
+  "        df_overflow(__builtin_sub_overflow(0, lhs, &lhs));\n"
+  "      else\n"
+  "        lhs /= rhs;\n"
+  "      break;\n"
+  "    case '=': lhs = lhs == rhs? -1: 0; break;\n"
+  "    case '>': lhs = lhs > rhs? -1: 0; break;\n"
+  "    case '&': lhs = lhs == -1 && rhs == -1? -1: 0; break;\n"
+  "    case '|': lhs = lhs == -1 || rhs == -1? -1: 0; break;\n"
+  "  }\n"
+  "  df_push(VALUE_TYPE, lhs);\n"
+  "}\n"
+  "\n"
+  "static inline void df_unary(int op)\n"
+  "{\n"
+  "  df_value_t value = df_pop_type(VALUE_TYPE);\n"
+  "  if (op == '_')\n"
+  "    df_overflow(__builtin_sub_overflow(0, value, &value));\n"
+  "  else\n"
+  "    value = value == 0? -1: 0;\n"
+  "  df_push(VALUE_TYPE, value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_addi(df_value_t imm)\n"
+  "{\n"
+  "  df_value_t value = df_pop_type(VALUE_TYPE);\n"
+  "  df_overflow(__builtin_add_overflow(value, imm, &value));\n"
+  "  df_push(VALUE_TYPE, value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_assign(void)\n"
+  "{\n"
+  "  int varadr = df_pop_type(VARADR_TYPE);\n"
+  "  df_vars[varadr] = df_pop();\n"
+  "}\n"
+  "\n"
+  "static inline void df_rval(void)\n"
+  "{\n"
+  "  df_cell_t cell = df_vars[df_pop_type(VARADR_TYPE)];\n"
+  "  df_push(cell.type, cell.value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_load(int varadr)\n"
+  "{\n"
+  "  df_push(df_vars[varadr].type, df_vars[varadr].value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_duplicate(void)\n"
+  "{\n"
+  "  df_cell_t cell = df_pop();\n"
+  "  df_push(cell.type, cell.value);\n"
+  "  df_push(cell.type, cell.value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_swap(void)\n"
+  "{\n"
+  "  df_cell_t rhs = df_pop();\n"
+  "  df_cell_t lhs = df_pop();\n"
+  "  df_push(rhs.type, rhs.value);\n"
+  "  df_push(lhs.type, lhs.value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_rot(void)\n"
+  "{\n"
+  "  df_cell_t c = df_pop();\n"
+  "  df_cell_t b = df_pop();\n"
+  "  df_cell_t a = df_pop();\n"
+  "  df_push(b.type, b.value);\n"
+  "  df_push(c.type, c.value);\n"
+  "  df_push(a.type, a.value);\n"
+  "}\n"
+  "\n"
+  "static inline void df_pick(void)\n"
+  "{\n"
+  "  df_value_t index = df_pop_type(VALUE_TYPE);\n"
+  "  if (index < 0 || (size_t)index >= df_size)\n"
+  "    df_fail(\"you pick too deep\");\n"
+  "  df_cell_t cell = df_data[df_size-1-index];\n"
+  "  df_push(cell.type, cell.value);\n"
+  "}\n"
+  "\n"
+  "static inline df_value_t* df_cell(void)\n"
+  "{\n"
+  "  df_value_t index = df_pop_type(VALUE_TYPE);\n"
+  "  if (index < 0 || (size_t)index >= DF_MEMORY)\n"
+  "    df_fail(\"memory index out of range\");\n"
+  "  return df_memory+index;\n"
+  "}\n"
+  "\n"
+  "static inline void df_put(void)\n"
+  "{\n"
+  "  df_value_t* cell = df_cell();\n"
+  "  *cell = df_pop_type(VALUE_TYPE);\n"
+  "}\n"
+  "\n"
+  "static inline df_frame_t* df_enter(int type, int ret)\n"
+  "{\n"
+  "  if (df_depth == df_frames_capacity) {\n"
+  "    if (df_depth == DF_RSTACK)\n"
+  "      df_fail(\"return stack overflow\");\n"
+  "    df_frames_capacity = df_frames_capacity? df_frames_capacity*2: BUFSIZ;\n"
+  "    if (df_frames_capacity > DF_RSTACK)\n"
+  "      df_frames_capacity = DF_RSTACK;\n"
+  "    df_frames = realloc(df_frames, df_frames_capacity*sizeof(df_frame_t));\n"
+  "    if (df_frames == NULL)\n"
+  "      df_fail(\"out of memory\");\n"
+  "  }\n"
+  "  df_frame_t* frame = df_frames+df_depth++;\n"
+  "  frame->type = type;\n"
+  "  frame->ret = ret;\n"
+  "  return frame;\n"
+  "}\n"
+  "\n";
+
+// compiler
+static void cgen_lambda(const program_t* program, const insn_t* first, int* resume, FILE* out);
+static void cgen_call(const char* target, const int resume, FILE* out);
+static void cgen_return(const program_t* program, const int resumes, FILE* out);
+static const insn_t* cgen_insn(const program_t* program, const insn_t* pc, int* resume, FILE* out);
+static void cgen_quote(const program_t* program, const insn_t* pc, FILE* out);
+
+// every lambda is a label in one function that keeps its own return stack,
+// so neither calls nor tail calls lean on the c stack or the optimizer
+int cgen(const program_t* program, const size_t memory, const size_t rstack, FILE* out)
+{
+  fputs("/* generated by dfalse --emit-c */\n", out);
+  fprintf(out, "typedef %s df_value_t;\n", CELL_BITS == 64? "long long": "int");
+  fprintf(out, "#define DF_TRAP %d\n", program->trap);
+  fprintf(out, "#define DF_MEMORY %zu\n", memory);
+  fprintf(out, "#define DF_RSTACK %zu\n", rstack);
+  fputs(g_runtime, out);
+
+  int calls = 0;
+  for (size_t i = 0; i < program->size; i++)
+    switch (program->insns[i].op) {
+      case CODE_OP:
+      case APPLY_OP:
+      case TAILAPPLY_OP:
+      case IF_OP:
+      case TAILIF_OP:
+      case WHILE_OP:
+      case CALLVAR_OP:
+      case TAILCALLVAR_OP: {
+        calls = 1;
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+
+  int resume = 0;
+  fputs("static void df_run(void)\n{\n", out);
+  if (calls)
+    fputs("  int code;\n", out);
+  cgen_lambda(program, program->insns, &resume, out);
+  for (size_t i = 0; i < program->size; i++)
+    if (program->insns[i].op == CODE_OP)
+      cgen_lambda(program, program->insns+i+1, &resume, out);
+  if (calls)
+    cgen_return(program, resume, out);
+  fputs(
+      "}\n"
+      "\n"
+      "int main(void)\n"
+      "{\n"
+      "  df_run();\n"
+      "  fflush(stdout);\n"
+      "  if (df_size != 0)\n"
+      "    df_fail(\"stack is not empty\");\n"
+      "  return 0;\n"
+      "}\n", out);
+
+  if (ferror(out)) {
+    err_msg(sys_msg());
+    return -1;
+  }
+  return 0;
+}
+
+static void cgen_lambda(const program_t* program, const insn_t* first, int* resume, FILE* out)
+{
+  if (first != program->insns)
+    fprintf(out, "df_%zu:\n", (size_t)(first-program->insns));
+  const insn_t* pc = first;
+  while (pc->op != RET_OP && pc->op != HALT_OP)
+    pc = cgen_insn(program, pc, resume, out);
+  fputs(pc->op == RET_OP? "  goto df_return;\n": "  return;\n", out);
+}
+
+static void cgen_call(const char* target, const int resume, FILE* out)
+{
+  fprintf(out,
+      "  df_enter(DF_CALL, %d);\n"
+      "  goto %s;\n"
+      "df_r%d:\n",
+      resume, target, resume);
+}
+
+// a ret leaves a call frame for the place it was made from, and turns
+// a while frame over from its condition to its body and back
+static void cgen_return(const program_t* program, const int resumes, FILE* out)
+{
+  int lambdas = 0;
+  fputs(
+      "df_dispatch:\n"
+      "  switch (code) {\n", out);
+  for (size_t i = 0; i < program->size; i++)
+    if (program->insns[i].op == CODE_OP) {
+      fprintf(out, "    case %zu: goto df_%zu;\n", i+1, i+1);
+      lambdas = 1;
+    }
+  fputs("  }\n", out);
+  // without a lambda no call gets past its type check
+  if (!lambdas) {
+    fputs("  return;\n", out);
+    return;
+  }
+
+  fputs(
+      "df_return:\n"
+      "  switch (df_frames[df_depth-1].type) {\n"
+      "    case DF_COND:\n"
+      "      if (df_pop_type(VALUE_TYPE) == 0)\n"
+      "        break;\n"
+      "      df_frames[df_depth-1].type = DF_BODY;\n"
+      "      code = df_frames[df_depth-1].body;\n"
+      "      goto df_dispatch;\n"
+      "    case DF_BODY:\n"
+      "      df_frames[df_depth-1].type = DF_COND;\n"
+      "      code = df_frames[df_depth-1].cond;\n"
+      "      goto df_dispatch;\n"
+      "  }\n"
+      "  switch (df_frames[--df_depth].ret) {\n", out);
+  for (int i = 0; i < resumes; i++)
+    fprintf(out, "    case %d: goto df_r%d;\n", i, i);
+  fputs("  }\n", out);
+}
+
+static const insn_t* cgen_insn(const program_t* program, const insn_t* pc, int* resume, FILE* out)
+{
+  static const char binops[__OPCODE_BOUND__] = {
+    [PLUS_OP] = '+',
+    [MINUS_OP] = '-',
+    [MULTIPLE_OP] = '*',
+    [DIVIDE_OP] = '/',
+    [ISEQUAL_OP] = '=',
+    [ISGREATER_OP] = '>',
+    [AND_OP] = '&',
+    [OR_OP] = '|',
+  };
+
+  char target[BUFSIZ];
+  switch (pc->op) {
+    case CODE_OP: {
+      // a literal lambda consumed right away is jumped to by its label
+      size_t entry = pc-program->insns+1;
+      const insn_t* next = program->insns+pc->arg;
+      snprintf(target, sizeof(target), "df_%zu", entry);
+      switch (next->op) {
+        case APPLY_OP: {
+          cgen_call(target, (*resume)++, out);
+          return next+1;
+        }
+        case TAILAPPLY_OP: {
+          fprintf(out, "  goto %s;\n", target);
+          return next+1;
+        }
+        case IF_OP: {
+          fputs("  if (df_pop_type(VALUE_TYPE) != 0) {\n", out);
+          fprintf(out, "    df_enter(DF_CALL, %d);\n    goto %s;\n  }\n", *resume, target);
+          fprintf(out, "df_r%d:\n", (*resume)++);
+          return next+1;
+        }
+        case TAILIF_OP: {
+          fprintf(out, "  if (df_pop_type(VALUE_TYPE) != 0)\n    goto %s;\n", target);
+          return next+1;
+        }
+        case CODE_OP: {
+          const insn_t* last = program->insns+next->arg;
+          if (last->op != WHILE_OP)
+            break;
+          fprintf(out,
+              "  {\n"
+              "    df_frame_t* frame = df_enter(DF_COND, %d);\n"
+              "    frame->cond = %zu;\n"
+              "    frame->body = %zu;\n"
+              "  }\n"
+              "  goto %s;\n"
+              "df_r%d:\n",
+              *resume, entry, (size_t)(next-program->insns+1), target, *resume);
+          (*resume)++;
+          return last+1;
+        }
+        default: {
+          break;
+        }
+      }
+      fprintf(out, "  df_push(CODE_TYPE, %zu);\n", entry);
+      return next;
+    }
+    case VARADR_OP: {
+      fprintf(out, "  df_push(VARADR_TYPE, %d);\n", (int)pc->arg);
+      break;
+    }
+    case VALUE_OP: {
+      fprintf(out, "  df_push(VALUE_TYPE, %lld);\n", (long long)pc->arg);
+      break;
+    }
+    case ASSIGN_OP: {
+      fputs("  df_assign();\n", out);
+      break;
+    }
+    case RVAL_OP: {
+      fputs("  df_rval();\n", out);
+      break;
+    }
+    case APPLY_OP: {
+      fputs("  code = df_pop_type(CODE_TYPE);\n", out);
+      cgen_call("df_dispatch", (*resume)++, out);
+      break;
+    }
+    case TAILAPPLY_OP: {
+      fputs("  code = df_pop_type(CODE_TYPE);\n  goto df_dispatch;\n", out);
+      break;
+    }
+    case PLUS_OP:
+    case MINUS_OP:
+    case MULTIPLE_OP:
+    case DIVIDE_OP:
+    case ISEQUAL_OP:
+    case ISGREATER_OP:
+    case AND_OP:
+    case OR_OP: {
+      fprintf(out, "  df_binary('%c');\n", binops[pc->op]);
+      break;
+    }
+    case NEGATE_OP: {
+      fputs("  df_unary('_');\n", out);
+      break;
+    }
+    case NOT_OP:
+    case ISZERO_OP: {
+      fputs("  df_unary('~');\n", out);
+      break;
+    }
+    case DUPLICATE_OP: {
+      fputs("  df_duplicate();\n", out);
+      break;
+    }
+    case DUPDUP_OP: {
+      fputs("  df_duplicate();\n  df_duplicate();\n", out);
+      break;
+    }
+    case DELETE_OP: {
+      fputs("  df_pop();\n", out);
+      break;
+    }
+    case SWAP_OP: {
+      fputs("  df_swap();\n", out);
+      break;
+    }
+    case ROT_OP: {
+      fputs("  df_rot();\n", out);
+      break;
+    }
+    case PICK_OP: {
+      fputs("  df_pick();\n", out);
+      break;
+    }
+    case IF_OP: {
+      fputs(
+          "  code = df_pop_type(CODE_TYPE);\n"
+          "  if (df_pop_type(VALUE_TYPE) != 0) {\n", out);
+      fprintf(out, "    df_enter(DF_CALL, %d);\n    goto df_dispatch;\n  }\n", *resume);
+      fprintf(out, "df_r%d:\n", (*resume)++);
+      break;
+    }
+    case TAILIF_OP: {
+      fputs(
+          "  code = df_pop_type(CODE_TYPE);\n"
+          "  if (df_pop_type(VALUE_TYPE) != 0)\n"
+          "    goto df_dispatch;\n", out);
+      break;
+    }
+    case WHILE_OP: {
+      fprintf(out,
+          "  {\n"
+          "    int body = df_pop_type(CODE_TYPE);\n"
+          "    int cond = df_pop_type(CODE_TYPE);\n"
+          "    df_frame_t* frame = df_enter(DF_COND, %d);\n"
+          "    frame->cond = cond;\n"
+          "    frame->body = body;\n"
+          "    code = cond;\n"
+          "  }\n"
+          "  goto df_dispatch;\n"
+          "df_r%d:\n",
+          *resume, *resume);
+      (*resume)++;
+      break;
+    }
+    case TOINT_OP: {
+      fputs("  printf(\"%lld\", (long long)df_pop_type(VALUE_TYPE));\n", out);
+      break;
+    }
+    case QUOTE_OP: {
+      cgen_quote(program, pc, out);
+      break;
+    }
+    case TOCHAR_OP: {
+      fputs("  putchar(df_pop_type(VALUE_TYPE));\n", out);
+      break;
+    }
+    case GETC_OP: {
+      fputs("  df_push(VALUE_TYPE, getchar());\n", out);
+      break;
+    }
+    case FLUSH_OP: {
+      fputs("  fflush(stdout);\n", out);
+      break;
+    }
+    case GET_OP: {
+      fputs("  df_push(VALUE_TYPE, *df_cell());\n", out);
+      break;
+    }
+    case PUT_OP: {
+      fputs("  df_put();\n", out);
+      break;
+    }
+    case LOAD_OP: {
+      fprintf(out, "  df_load(%d);\n", (int)pc->arg);
+      break;
+    }
+    case STORE_OP: {
+      fprintf(out, "  df_vars[%d] = df_pop();\n", (int)pc->arg);
+      break;
+    }
+    case CALLVAR_OP: {
+      fprintf(out, "  code = df_expect(df_vars[%d], CODE_TYPE);\n", (int)pc->arg);
+      cgen_call("df_dispatch", (*resume)++, out);
+      break;
+    }
+    case TAILCALLVAR_OP: {
+      fprintf(out, "  code = df_expect(df_vars[%d], CODE_TYPE);\n  goto df_dispatch;\n", (int)pc->arg);
+      break;
+    }
+    case ADDI_OP: {
+      fprintf(out, "  df_addi(%lld);\n", (long long)pc->arg);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+  return pc+1;
+}
+
+static void cgen_quote(const program_t* program, const insn_t* pc, FILE* out)
+{
+  int size;
+  const char* span = program->strings.data+pc->arg;
+  memcpy(&size, span, sizeof(size));
+
+  fputs("  fwrite(\"", out);
+  const unsigned char* it = (const unsigned char*)span+sizeof(size);
+  for (int i = 0; i < size; i++) {
+    if (it[i] == '"' || it[i] == '\\' || it[i] == '?')
+      fprintf(out, "\\%c", it[i]);
+    else if (it[i] < ' ' || it[i] > '~')
+      fprintf(out, "\\%03o", it[i]);
+    else
+      fputc(it[i], out);
+  }
+  fprintf(out, "\", 1, %d, stdout);\n", size);
+}
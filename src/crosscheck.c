@@ -0,0 +1,384 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "dfalse.h"
+
+// misc
+#define ARGS_LIMIT 8
+static void usage(const char* name);
+static const char* sys_msg();
+static void err_msg(const char* fmt, ...);
+
+// input
+static const char* g_text = "the quick brown fox jumps over the lazy dog\n";
+#define INPUT_LINES 64
+static int g_input = -1;
+static int mkinput();
+
+// run
+typedef struct flavor_t {
+  const char* name;
+  int jit;
+  int trap;
+  int library;
+} flavor_t;
+static const flavor_t g_flavors[] = {
+  {"interpreted", 0, 0, 0},
+  {"jitted", 1, 0, 0},
+  {"library", 0, 0, 1},
+  {"library jitted", 1, 0, 1},
+  {"interpreted -o", 0, 1, 0},
+  {"jitted -o", 1, 1, 0},
+  {"library -o", 0, 1, 1},
+  {"library jitted -o", 1, 1, 1},
+};
+#define FLAVORS (sizeof(g_flavors)/sizeof(g_flavors[0]))
+typedef struct outcome_t {
+  char* data;
+  size_t size;
+  int ok;
+} outcome_t;
+static const char* g_memory;
+static int spawn(const char* dfalse, const flavor_t* flavor, const char* file, outcome_t* outcome);
+static int slurp(const int fd, outcome_t* outcome);
+
+// library
+typedef struct stream_t {
+  const char* in;
+  size_t left;
+  outcome_t* out;
+} stream_t;
+static int embed(const flavor_t* flavor, const char* file, outcome_t* outcome);
+static long sread(void* user, char* data, size_t size);
+static long swrite(void* user, const char* data, size_t size);
+static void serror(void* user, const char* message);
+static int check(const char* dfalse, const char* file);
+
+int main(int argc, char* argv[])
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "m:h")) != -1)
+    switch (opt) {
+      case 'm': {
+        g_memory = optarg;
+        break;
+      }
+      case 'h': {
+        usage(argv[0]);
+        return 0;
+      }
+      default: {
+        usage(argv[0]);
+        goto err_0;
+      }
+    }
+
+  if (argc-optind < 2) {
+    usage(argv[0]);
+    goto err_0;
+  }
+
+  const char* dfalse = argv[optind++];
+  g_input = mkinput();
+  if (g_input < 0) {
+    err_msg("make input failed");
+    goto err_0;
+  }
+
+  int failed = 0;
+  for (int i = optind; i < argc; i++) {
+    int result = check(dfalse, argv[i]);
+    if (result < 0) {
+      err_msg("check %s failed", argv[i]);
+      goto err_1;
+    }
+    failed |= result;
+  }
+
+  close(g_input);
+  return failed? -1: 0;
+err_1:
+  close(g_input);
+err_0:
+  return -1;
+}
+
+static void usage(const char* name)
+{
+  fprintf(stderr,
+      "usage: %s [options] <dfalse> <program.df>...\n"
+      "  -m CELLS  give every run a heap of CELLS cells\n"
+      "  -h        show this message\n",
+      name);
+}
+
+static const char* sys_msg()
+{
+  return strerror(errno);
+}
+
+static void err_msg(const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "\e[31m");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\e[0m\n");
+  va_end(ap);
+}
+
+// every run reads the same unlinked file, rewound before each one
+static int mkinput()
+{
+  char name[] = "/tmp/dfalse-check-XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    err_msg("%s: %s", name, sys_msg());
+    goto err_0;
+  }
+  unlink(name);
+
+  size_t length = strlen(g_text);
+  for (int i = 0; i < INPUT_LINES; i++)
+    if (write(fd, g_text, length) != length) {
+      err_msg(sys_msg());
+      goto err_1;
+    }
+  return fd;
+err_1:
+  close(fd);
+err_0:
+  return -1;
+}
+
+static int spawn(const char* dfalse, const flavor_t* flavor, const char* file, outcome_t* outcome)
+{
+  char name[] = "/tmp/dfalse-check-XXXXXX";
+  int out = mkstemp(name);
+  if (out < 0) {
+    err_msg("%s: %s", name, sys_msg());
+    goto err_0;
+  }
+  unlink(name);
+
+  char memory[BUFSIZ];
+  char* argv[ARGS_LIMIT];
+  int argc = 0;
+  argv[argc++] = (char*)dfalse;
+  if (flavor->jit)
+    argv[argc++] = "--jit";
+  if (flavor->trap)
+    argv[argc++] = "--trap-overflow";
+  if (g_memory) {
+    snprintf(memory, sizeof(memory), "--memory=%s", g_memory);
+    argv[argc++] = memory;
+  }
+  argv[argc++] = (char*)file;
+  argv[argc] = NULL;
+
+  if (lseek(g_input, 0, SEEK_SET) < 0) {
+    err_msg(sys_msg());
+    goto err_1;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    err_msg(sys_msg());
+    goto err_1;
+  }
+
+  // diagnostics are left out, only what the program prints is compared
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null < 0 || dup2(g_input, STDIN_FILENO) < 0
+        || dup2(out, STDOUT_FILENO) < 0 || dup2(null, STDERR_FILENO) < 0)
+      _exit(127);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  int wstatus;
+  while (waitpid(pid, &wstatus, 0) < 0)
+    if (errno != EINTR) {
+      err_msg(sys_msg());
+      goto err_1;
+    }
+
+  if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 127) {
+    err_msg("%s: cannot run", dfalse);
+    goto err_1;
+  }
+  outcome->ok = WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+  if (slurp(out, outcome) != 0)
+    goto err_1;
+  close(out);
+  return 0;
+err_1:
+  close(out);
+err_0:
+  return -1;
+}
+
+static int slurp(const int fd, outcome_t* outcome)
+{
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+    err_msg(sys_msg());
+    goto err_0;
+  }
+
+  outcome->data = malloc(size+1);
+  if (outcome->data == NULL) {
+    err_msg(sys_msg());
+    goto err_0;
+  }
+
+  outcome->size = 0;
+  while (outcome->size < size) {
+    ssize_t count = read(fd, outcome->data+outcome->size, size-outcome->size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0) {
+      err_msg(count < 0? sys_msg(): "short read");
+      goto err_1;
+    }
+    outcome->size += count;
+  }
+  return 0;
+err_1:
+  free(outcome->data);
+  outcome->data = NULL;
+err_0:
+  return -1;
+}
+
+// the same run in process, reading the same text and writing into memory
+static int embed(const flavor_t* flavor, const char* file, outcome_t* outcome)
+{
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    err_msg("%s: %s", file, sys_msg());
+    goto err_0;
+  }
+
+  outcome_t source;
+  int failed = slurp(fd, &source);
+  close(fd);
+  if (failed)
+    goto err_0;
+
+  size_t length = strlen(g_text);
+  char* input = malloc(length*INPUT_LINES);
+  if (input == NULL) {
+    err_msg(sys_msg());
+    goto err_1;
+  }
+  for (int i = 0; i < INPUT_LINES; i++)
+    memcpy(input+i*length, g_text, length);
+
+  outcome->data = NULL;
+  outcome->size = 0;
+  stream_t stream = {input, length*INPUT_LINES, outcome};
+  dfalse_config_t config = {sread, swrite, serror, &stream,
+    g_memory? strtoul(g_memory, NULL, 10): 0, 0};
+  int flags = (flavor->jit? DFALSE_JIT: 0)|(flavor->trap? DFALSE_TRAP_OVERFLOW: 0);
+  dfalse_program_t* program = dfalse_compile(source.data, source.size, flags, &config);
+  dfalse_t* vm = dfalse_new(&config);
+  if (vm == NULL) {
+    err_msg("dfalse_new failed");
+    goto err_2;
+  }
+
+  // a program that does not compile fails like the cli does
+  outcome->ok = program != NULL && dfalse_run(vm, program) == 0;
+  dfalse_free(vm);
+  dfalse_program_free(program);
+  free(input);
+  free(source.data);
+  return 0;
+err_2:
+  dfalse_program_free(program);
+  free(outcome->data);
+  outcome->data = NULL;
+  free(input);
+err_1:
+  free(source.data);
+err_0:
+  return -1;
+}
+
+static long sread(void* user, char* data, size_t size)
+{
+  stream_t* stream = user;
+  if (size > stream->left)
+    size = stream->left;
+  memcpy(data, stream->in, size);
+  stream->in += size;
+  stream->left -= size;
+  return size;
+}
+
+static long swrite(void* user, const char* data, size_t size)
+{
+  outcome_t* out = ((stream_t*)user)->out;
+  char* bud = realloc(out->data, out->size+size);
+  if (bud == NULL)
+    return -1;
+  memcpy(bud+out->size, data, size);
+  out->data = bud;
+  out->size += size;
+  return size;
+}
+
+static void serror(void* user, const char* message)
+{
+}
+
+// 1 when some run prints or ends differently from the first one
+static int check(const char* dfalse, const char* file)
+{
+  outcome_t outcomes[FLAVORS];
+  size_t size = 0;
+  for (; size < FLAVORS; size++)
+    if ((g_flavors[size].library? embed(g_flavors+size, file, outcomes+size)
+          : spawn(dfalse, g_flavors+size, file, outcomes+size)) != 0)
+      goto err_0;
+
+  int failed = 0;
+  for (size_t i = 0; i < FLAVORS; i++) {
+    // each run is held against the first one under the same overflow rule
+    size_t first = 0;
+    while (g_flavors[first].trap != g_flavors[i].trap)
+      first++;
+    if (first == i)
+      continue;
+
+    const outcome_t* expect = outcomes+first;
+    const outcome_t* got = outcomes+i;
+    if (got->ok != expect->ok || got->size != expect->size
+        || (got->size && memcmp(got->data, expect->data, got->size) != 0)) {
+      err_msg("%s: %s differs", file, g_flavors[i].name);
+      failed = 1;
+    }
+  }
+  printf("%s %s\n", failed? "FAIL": "ok", file);
+
+  for (size_t i = 0; i < size; i++)
+    free(outcomes[i].data);
+  return failed;
+err_0:
+  for (size_t i = 0; i < size; i++)
+    free(outcomes[i].data);
+  return -1;
+}
@@ -0,0 +1,54 @@
+#ifndef DFALSE_H_
+#define DFALSE_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a compiled program, read-only once compiled, so threads may share one
+typedef struct dfalse_program_t dfalse_program_t;
+// an interpreter with its own stacks, variables, heap, i/o and copy of the
+// program it runs; one thread at a time
+typedef struct dfalse_t dfalse_t;
+
+// one diagnostic per call, without a trailing newline
+typedef void dfalse_error_i(void* user, const char* message);
+// both return the bytes moved, or -1 on error; a read of 0 is end of input,
+// a write must move at least one byte, a write of 0 fails the run
+typedef long dfalse_read_i(void* user, char* data, size_t size);
+typedef long dfalse_write_i(void* user, const char* data, size_t size);
+
+typedef struct dfalse_config_t {
+  dfalse_read_i* read;    // NULL reads stdin
+  dfalse_write_i* write;  // NULL writes stdout
+  dfalse_error_i* error;  // NULL reports on stderr
+  void* user;             // handed back to read, write and error
+  size_t memory;          // heap cells for G and P, none if 0
+  size_t rstack;          // return stack frame limit, the default if 0
+} dfalse_config_t;
+
+// dfalse_compile flags
+#define DFALSE_JIT 1
+#define DFALSE_TRAP_OVERFLOW 2
+
+// the source is copied, errors give NULL; of the config only error and user
+// are used, for this and every later report about the program's source
+dfalse_program_t* dfalse_compile(const char* source, size_t length, int flags,
+    const dfalse_config_t* config);
+void dfalse_program_free(dfalse_program_t* program);
+
+// a NULL config reads stdin and writes stdout with no heap
+dfalse_t* dfalse_new(const dfalse_config_t* config);
+// every run starts on empty stacks and variables, and on fresh input when a
+// read callback is given, the heap is kept; 0 when the program halts with
+// an empty stack and all of its output written
+int dfalse_run(dfalse_t* vm, dfalse_program_t* program);
+void dfalse_free(dfalse_t* vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DFALSE_H_
@@ -0,0 +1,905 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "vm.h"
+
+#if defined(__x86_64__)
+
+// assembler
+typedef enum reg_e {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+  __REG_BOUND__
+} reg_e;
+#define NOREG __REG_BOUND__
+typedef enum cc_e {
+  CC_O = 0x0,
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_G = 0xf,
+  __CC_BOUND__
+} cc_e;
+typedef struct mem_t {
+  reg_e base;
+  reg_e index;
+  int scale;
+  int disp;
+} mem_t;
+typedef struct asm_t {
+  unsigned char* data;
+  size_t size;
+  size_t capacity;
+  const report_t* report;
+} asm_t;
+#define ASM_SLACK 256
+static int areserve(asm_t* a);
+static void abyte(asm_t* a, const int byte);
+static void aimm32(asm_t* a, const int32_t imm);
+static void aimm64(asm_t* a, const uint64_t imm);
+static void amem(asm_t* a, const int w, const int opcode, const int reg, const mem_t mem);
+static void areg(asm_t* a, const int w, const int opcode, const int reg, const int rm);
+static void aload(asm_t* a, const int w, const reg_e reg, const mem_t mem);
+static void astore(asm_t* a, const int w, const mem_t mem, const reg_e reg);
+static void astorei(asm_t* a, const int w, const mem_t mem, const int32_t imm);
+static void acmpi(asm_t* a, const int w, const mem_t mem, const int8_t imm);
+static void amovi(asm_t* a, const int w, const reg_e reg, const int64_t imm);
+static void aalui(asm_t* a, const int w, const int ext, const reg_e reg, const int32_t imm);
+static void acopy(asm_t* a, const mem_t dst, const mem_t src);
+static void asetcc(asm_t* a, const cc_e cc, const reg_e reg);
+static size_t ajcc(asm_t* a, const cc_e cc);
+static size_t ajmp(asm_t* a);
+static void apatch(asm_t* a, const size_t at, const size_t target);
+
+// register roles inside a block
+#define TOP_REG RBX
+#define STACK_REG R12
+#define VARS_REG R13
+#define MEMORY_REG R14
+#define CACHE_REG RAX
+#define SLOT ((int)sizeof(type_t))
+#define SLOT_SHIFT (SLOT == 16? 4: 3)
+#define SIB_SHIFT 3
+#define TAG ((int)offsetof(type_t, type))
+#define CELL ((int)offsetof(type_t, data))
+#define CELL_W (sizeof(((type_t*)0)->data.value) == 8)
+_Static_assert(sizeof(type_t) == 1<<SLOT_SHIFT, "type_t must be a power of two");
+
+// compiler
+typedef struct exit_t {
+  size_t patch;
+  const insn_t* pc;
+  int cached;
+} exit_t;
+typedef struct jitter_t {
+  asm_t code;
+  exit_t* exits;
+  size_t size;
+  size_t capacity;
+  int cached;
+} jitter_t;
+typedef struct effect_t {
+  signed char ok;
+  signed char pop;
+  signed char push;
+} effect_t;
+static const effect_t* jit_effect(const opcode_e op);
+static const insn_t* jit_walk(const program_t* program, const insn_t* pc, size_t* need, size_t* grow, size_t* count);
+static int jit_block(jitter_t* jitter, const program_t* program, const insn_t* first);
+static int jit_insn(jitter_t* jitter, const program_t* program, const insn_t* pc);
+static int jit_exit(jitter_t* jitter, const cc_e cc, const insn_t* pc);
+static int jit_trap(jitter_t* jitter, const insn_t* pc);
+static void jit_flush(jitter_t* jitter);
+static int jit_fetch(jitter_t* jitter, const insn_t* pc);
+static mem_t jit_slot(const int depth, const int field);
+static mem_t jit_var(const int varadr, const int field);
+static mem_t jit_index(asm_t* a, const reg_e base, const reg_e index, const int disp);
+static int jit_cell(jitter_t* jitter, const insn_t* pc, mem_t* cell);
+
+
+int jit_compile(program_t* program)
+{
+  char* starts = calloc(program->size, 1);
+  if (starts == NULL) {
+    rerr_msg(&program->report, sys_msg());
+    goto err_0;
+  }
+
+  // a run may begin at the program entry, at a lambda entry or right after
+  // an instruction that is left to the interpreter
+  starts[0] = 1;
+  for (size_t i = 0; i+1 < program->size; i++) {
+    opcode_e op = program->insns[i].op;
+    if (op == CODE_OP || jit_effect(op) == NULL)
+      starts[i+1] = 1;
+  }
+
+  jitter_t jitter = {{NULL, 0, 0, &program->report}, NULL, 0, 0, 0};
+  size_t* offsets = NULL;
+  size_t* ats = NULL;
+  for (size_t i = 0; i < program->size; i++) {
+    const insn_t* first = program->insns+i;
+    size_t need, grow, count;
+    if (!starts[i])
+      continue;
+    jit_walk(program, first, &need, &grow, &count);
+    if (count < 2)
+      continue;
+
+    if (program->jit.size == program->jit.capacity) {
+      size_t capacity = program->jit.capacity? program->jit.capacity*2: BUFSIZ;
+      block_t* bud = realloc(program->jit.blocks, capacity*sizeof(block_t));
+      if (bud == NULL) {
+        rerr_msg(&program->report, sys_msg());
+        goto err_1;
+      }
+      program->jit.blocks = bud;
+      program->jit.capacity = capacity;
+
+      size_t* offbud = realloc(offsets, capacity*sizeof(size_t));
+      size_t* atbud = offbud? realloc(ats, capacity*sizeof(size_t)): NULL;
+      if (offbud) offsets = offbud;
+      if (atbud) ats = atbud;
+      if (offbud == NULL || atbud == NULL) {
+        rerr_msg(&program->report, sys_msg());
+        goto err_1;
+      }
+    }
+
+    offsets[program->jit.size] = jitter.code.size;
+    ats[program->jit.size] = i;
+    if (jit_block(&jitter, program, first) != 0)
+      goto err_1;
+
+    block_t* block = program->jit.blocks+program->jit.size++;
+    block->insn = *first;
+    block->native = NULL;
+    block->need = need;
+    block->grow = grow;
+  }
+
+  if (program->jit.size) {
+    long page = sysconf(_SC_PAGESIZE);
+    program->jit.length = (jitter.code.size+page-1)/page*page;
+    void* code = mmap(NULL, program->jit.length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+      rerr_msg(&program->report, sys_msg());
+      goto err_1;
+    }
+    program->jit.code = code;
+    memcpy(program->jit.code, jitter.code.data, jitter.code.size);
+    if (mprotect(program->jit.code, program->jit.length, PROT_READ|PROT_EXEC) != 0) {
+      rerr_msg(&program->report, sys_msg());
+      goto err_1;
+    }
+  }
+
+  // every run was compiled from the original bytecode, only now is it safe
+  // to displace the first instruction of each
+  for (size_t i = 0; i < program->jit.size; i++) {
+    program->jit.blocks[i].native = (native_i*)(program->jit.code+offsets[i]);
+    insn_t* insn = program->insns+ats[i];
+    insn->op = JIT_OP;
+    insn->arg = i;
+  }
+
+  free(ats);
+  free(offsets);
+  free(jitter.exits);
+  free(jitter.code.data);
+  free(starts);
+  return 0;
+err_1:
+  free(ats);
+  free(offsets);
+  free(jitter.exits);
+  free(jitter.code.data);
+  free(starts);
+  jit_free(program);
+err_0:
+  return -1;
+}
+
+static const effect_t* jit_effect(const opcode_e op)
+{
+  static const effect_t effects[__OPCODE_BOUND__] = {
+    [CODE_OP] = {1, 0, 1},
+    [VARADR_OP] = {1, 0, 1},
+    [VALUE_OP] = {1, 0, 1},
+    [ASSIGN_OP] = {1, 2, 0},
+    [RVAL_OP] = {1, 1, 1},
+    [PLUS_OP] = {1, 2, 1},
+    [MINUS_OP] = {1, 2, 1},
+    [MULTIPLE_OP] = {1, 2, 1},
+    [DIVIDE_OP] = {1, 2, 1},
+    [ISEQUAL_OP] = {1, 2, 1},
+    [ISGREATER_OP] = {1, 2, 1},
+    [AND_OP] = {1, 2, 1},
+    [OR_OP] = {1, 2, 1},
+    [NEGATE_OP] = {1, 1, 1},
+    [NOT_OP] = {1, 1, 1},
+    [DUPLICATE_OP] = {1, 1, 2},
+    [DELETE_OP] = {1, 1, 0},
+    [SWAP_OP] = {1, 2, 2},
+    [ROT_OP] = {1, 3, 3},
+    [PICK_OP] = {1, 1, 1},
+    [LOAD_OP] = {1, 0, 1},
+    [STORE_OP] = {1, 1, 0},
+    [ADDI_OP] = {1, 1, 1},
+    [ISZERO_OP] = {1, 1, 1},
+    [DUPDUP_OP] = {1, 1, 3},
+    [GET_OP] = {1, 1, 1},
+    [PUT_OP] = {1, 2, 0},
+  };
+  return effects[op].ok? effects+op: NULL;
+}
+
+static const insn_t* jit_walk(const program_t* program, const insn_t* pc, size_t* need, size_t* grow, size_t* count)
+{
+  long depth = 0;
+  long low = 0;
+  long high = 0;
+  const effect_t* effect;
+  for (*count = 0; (effect = jit_effect(pc->op)) != NULL; ++*count) {
+    depth -= effect->pop;
+    if (depth < low)
+      low = depth;
+    depth += effect->push;
+    if (depth > high)
+      high = depth;
+    pc = pc->op == CODE_OP? program->insns+pc->arg: pc+1;
+  }
+  *need = -low;
+  *grow = high;
+  return pc;
+}
+
+static int jit_block(jitter_t* jitter, const program_t* program, const insn_t* first)
+{
+  asm_t* a = &jitter->code;
+  jitter->size = 0;
+  jitter->cached = 0;
+
+  // prologue: load the stack top pointer, the vm state stays in memory
+  if (areserve(a) != 0)
+    goto err_0;
+  abyte(a, 0x53);
+  abyte(a, 0x41);
+  abyte(a, 0x54);
+  abyte(a, 0x41);
+  abyte(a, 0x55);
+  abyte(a, 0x41);
+  abyte(a, 0x56);
+  areg(a, 1, 0x89, RDI, STACK_REG);
+  areg(a, 1, 0x89, RSI, VARS_REG);
+  areg(a, 1, 0x89, RDX, MEMORY_REG);
+  aload(a, 1, TOP_REG, (mem_t){STACK_REG, NOREG, 0, offsetof(stack_t, data)});
+  aload(a, 1, RCX, (mem_t){STACK_REG, NOREG, 0, offsetof(stack_t, size)});
+  amem(a, 1, 0x8d, TOP_REG, jit_index(a, TOP_REG, RCX, 0));
+
+  const insn_t* pc = first;
+  while (jit_effect(pc->op) != NULL) {
+    if (jit_insn(jitter, program, pc) != 0)
+      goto err_0;
+    pc = pc->op == CODE_OP? program->insns+pc->arg: pc+1;
+  }
+
+  // epilogue: write the stack size back and hand the next pc to the caller
+  if (areserve(a) != 0)
+    goto err_0;
+  jit_flush(jitter);
+  abyte(a, 0x48);
+  abyte(a, 0xb8);
+  aimm64(a, (uintptr_t)pc);
+  size_t epilogue = a->size;
+  areg(a, 1, 0x89, TOP_REG, RCX);
+  amem(a, 1, 0x2b, RCX, (mem_t){STACK_REG, NOREG, 0, offsetof(stack_t, data)});
+  areg(a, 1, 0xc1, 5, RCX);
+  abyte(a, SLOT_SHIFT);
+  astore(a, 1, (mem_t){STACK_REG, NOREG, 0, offsetof(stack_t, size)}, RCX);
+  abyte(a, 0x41);
+  abyte(a, 0x5e);
+  abyte(a, 0x41);
+  abyte(a, 0x5d);
+  abyte(a, 0x41);
+  abyte(a, 0x5c);
+  abyte(a, 0x5b);
+  abyte(a, 0xc3);
+
+  // side exits spill the cached top and resume the interpreter at the
+  // instruction that could not be completed natively
+  for (size_t i = 0; i < jitter->size; i++) {
+    const exit_t* exit = jitter->exits+i;
+    if (areserve(a) != 0)
+      goto err_0;
+    apatch(a, exit->patch, a->size);
+    if (exit->cached) {
+      astorei(a, 0, jit_slot(-1, TAG), VALUE_TYPE);
+      astore(a, CELL_W, jit_slot(-1, CELL), CACHE_REG);
+      aalui(a, 1, 0, TOP_REG, SLOT);
+    }
+    abyte(a, 0x48);
+    abyte(a, 0xb8);
+    aimm64(a, (uintptr_t)exit->pc);
+    apatch(a, ajmp(a), epilogue);
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+static int jit_insn(jitter_t* jitter, const program_t* program, const insn_t* pc)
+{
+  asm_t* a = &jitter->code;
+  if (areserve(a) != 0)
+    goto err_0;
+
+  switch (pc->op) {
+    case CODE_OP:
+    case VARADR_OP: {
+      jit_flush(jitter);
+      int code = pc->op == CODE_OP;
+      astorei(a, 0, jit_slot(-1, TAG), code? CODE_TYPE: VARADR_TYPE);
+      astorei(a, CELL_W, jit_slot(-1, CELL), code? pc-program->insns+1: pc->arg);
+      aalui(a, 1, 0, TOP_REG, SLOT);
+      break;
+    }
+    case VALUE_OP: {
+      jit_flush(jitter);
+      amovi(a, CELL_W, CACHE_REG, pc->arg);
+      jitter->cached = 1;
+      break;
+    }
+    case LOAD_OP: {
+      jit_flush(jitter);
+      acopy(a, jit_slot(-1, 0), jit_var(pc->arg, 0));
+      aalui(a, 1, 0, TOP_REG, SLOT);
+      break;
+    }
+    case STORE_OP: {
+      if (jitter->cached) {
+        astorei(a, 0, jit_var(pc->arg, TAG), VALUE_TYPE);
+        astore(a, CELL_W, jit_var(pc->arg, CELL), CACHE_REG);
+        jitter->cached = 0;
+        break;
+      }
+      acopy(a, jit_var(pc->arg, 0), jit_slot(0, 0));
+      aalui(a, 1, 5, TOP_REG, SLOT);
+      break;
+    }
+    case ASSIGN_OP:
+    case RVAL_OP: {
+      jit_flush(jitter);
+      acmpi(a, 0, jit_slot(0, TAG), VARADR_TYPE);
+      if (jit_exit(jitter, CC_NE, pc) != 0)
+        goto err_0;
+      aload(a, 0, RCX, jit_slot(0, CELL));
+      mem_t var = jit_index(a, VARS_REG, RCX, 0);
+      if (pc->op == RVAL_OP) {
+        acopy(a, jit_slot(0, 0), var);
+        break;
+      }
+      acopy(a, var, jit_slot(1, 0));
+      aalui(a, 1, 5, TOP_REG, 2*SLOT);
+      break;
+    }
+    case PLUS_OP:
+    case MINUS_OP:
+    case MULTIPLE_OP:
+    case DIVIDE_OP:
+    case ISEQUAL_OP:
+    case ISGREATER_OP:
+    case AND_OP:
+    case OR_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      acmpi(a, 0, jit_slot(0, TAG), VALUE_TYPE);
+      if (jit_exit(jitter, CC_NE, pc) != 0)
+        goto err_0;
+
+      mem_t lhs = jit_slot(0, CELL);
+      switch (pc->op) {
+        case PLUS_OP:
+        case MULTIPLE_OP: {
+          int opcode = pc->op == PLUS_OP? 0x03: 0x0faf;
+          if (program->trap) {
+            areg(a, CELL_W, 0x89, CACHE_REG, RDX);
+            amem(a, CELL_W, opcode, RDX, lhs);
+            if (jit_trap(jitter, pc) != 0)
+              goto err_0;
+            break;
+          }
+          amem(a, CELL_W, opcode, CACHE_REG, lhs);
+          break;
+        }
+        case MINUS_OP:
+        case DIVIDE_OP: {
+          if (pc->op == MINUS_OP && program->trap) {
+            aload(a, CELL_W, RDX, lhs);
+            areg(a, CELL_W, 0x29, CACHE_REG, RDX);
+            if (jit_trap(jitter, pc) != 0)
+              goto err_0;
+            break;
+          }
+          // idiv faults on zero and on MIN/-1, leave both to the interpreter
+          if (pc->op == DIVIDE_OP) {
+            areg(a, CELL_W, 0x85, CACHE_REG, CACHE_REG);
+            if (jit_exit(jitter, CC_E, pc) != 0)
+              goto err_0;
+            aalui(a, CELL_W, 7, CACHE_REG, -1);
+            if (jit_exit(jitter, CC_E, pc) != 0)
+              goto err_0;
+          }
+          areg(a, CELL_W, 0x89, CACHE_REG, RCX);
+          aload(a, CELL_W, CACHE_REG, lhs);
+          if (pc->op == MINUS_OP) {
+            areg(a, CELL_W, 0x29, RCX, CACHE_REG);
+            break;
+          }
+          if (CELL_W)
+            abyte(a, 0x48);
+          abyte(a, 0x99);
+          areg(a, CELL_W, 0xf7, 7, RCX);
+          break;
+        }
+        case ISEQUAL_OP:
+        case ISGREATER_OP: {
+          amem(a, CELL_W, 0x39, CACHE_REG, lhs);
+          asetcc(a, pc->op == ISEQUAL_OP? CC_E: CC_G, CACHE_REG);
+          areg(a, 0, 0x0fb6, CACHE_REG, CACHE_REG);
+          areg(a, CELL_W, 0xf7, 3, CACHE_REG);
+          break;
+        }
+        default: {
+          aalui(a, CELL_W, 7, CACHE_REG, TRUE);
+          asetcc(a, CC_E, RCX);
+          acmpi(a, CELL_W, lhs, TRUE);
+          asetcc(a, CC_E, CACHE_REG);
+          areg(a, 0, pc->op == AND_OP? 0x20: 0x08, RCX, CACHE_REG);
+          areg(a, 0, 0x0fb6, CACHE_REG, CACHE_REG);
+          areg(a, CELL_W, 0xf7, 3, CACHE_REG);
+          break;
+        }
+      }
+      aalui(a, 1, 5, TOP_REG, SLOT);
+      break;
+    }
+    case NEGATE_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      if (program->trap) {
+        areg(a, CELL_W, 0x89, CACHE_REG, RDX);
+        areg(a, CELL_W, 0xf7, 3, RDX);
+        if (jit_trap(jitter, pc) != 0)
+          goto err_0;
+        break;
+      }
+      areg(a, CELL_W, 0xf7, 3, CACHE_REG);
+      break;
+    }
+    case NOT_OP:
+    case ISZERO_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      areg(a, CELL_W, 0x85, CACHE_REG, CACHE_REG);
+      asetcc(a, CC_E, CACHE_REG);
+      areg(a, 0, 0x0fb6, CACHE_REG, CACHE_REG);
+      areg(a, CELL_W, 0xf7, 3, CACHE_REG);
+      break;
+    }
+    case ADDI_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      reg_e reg = program->trap? RDX: CACHE_REG;
+      if (program->trap)
+        areg(a, CELL_W, 0x89, CACHE_REG, RDX);
+      if (pc->arg >= INT32_MIN && pc->arg <= INT32_MAX)
+        aalui(a, CELL_W, 0, reg, pc->arg);
+      else {
+        amovi(a, CELL_W, RCX, pc->arg);
+        areg(a, CELL_W, 0x01, RCX, reg);
+      }
+      if (program->trap && jit_trap(jitter, pc) != 0)
+        goto err_0;
+      break;
+    }
+    case DUPLICATE_OP:
+    case DUPDUP_OP: {
+      int copies = pc->op == DUPDUP_OP? 2: 1;
+      for (int i = 0; i < copies; i++) {
+        if (jitter->cached) {
+          astorei(a, 0, jit_slot(-1, TAG), VALUE_TYPE);
+          astore(a, CELL_W, jit_slot(-1, CELL), CACHE_REG);
+        }
+        else
+          acopy(a, jit_slot(-1, 0), jit_slot(0, 0));
+        aalui(a, 1, 0, TOP_REG, SLOT);
+      }
+      break;
+    }
+    case DELETE_OP: {
+      if (jitter->cached) {
+        jitter->cached = 0;
+        break;
+      }
+      aalui(a, 1, 5, TOP_REG, SLOT);
+      break;
+    }
+    case SWAP_OP: {
+      jit_flush(jitter);
+      for (int off = 0; off < SLOT; off += 8) {
+        aload(a, 1, RCX, jit_slot(0, off));
+        aload(a, 1, RDX, jit_slot(1, off));
+        astore(a, 1, jit_slot(0, off), RDX);
+        astore(a, 1, jit_slot(1, off), RCX);
+      }
+      break;
+    }
+    case ROT_OP: {
+      jit_flush(jitter);
+      for (int off = 0; off < SLOT; off += 8) {
+        aload(a, 1, RCX, jit_slot(2, off));
+        aload(a, 1, RDX, jit_slot(1, off));
+        astore(a, 1, jit_slot(2, off), RDX);
+        aload(a, 1, RDX, jit_slot(0, off));
+        astore(a, 1, jit_slot(1, off), RDX);
+        astore(a, 1, jit_slot(0, off), RCX);
+      }
+      break;
+    }
+    case PICK_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      areg(a, 1, 0x89, TOP_REG, RCX);
+      amem(a, 1, 0x2b, RCX, (mem_t){STACK_REG, NOREG, 0, offsetof(stack_t, data)});
+      areg(a, 1, 0xc1, 5, RCX);
+      abyte(a, SLOT_SHIFT);
+      areg(a, CELL_W, 0x39, RCX, CACHE_REG);
+      if (jit_exit(jitter, CC_AE, pc) != 0)
+        goto err_0;
+      areg(a, CELL_W, 0x89, CACHE_REG, RCX);
+      areg(a, 1, 0xf7, 3, RCX);
+      acopy(a, jit_slot(-1, 0), jit_index(a, TOP_REG, RCX, -SLOT));
+      aalui(a, 1, 0, TOP_REG, SLOT);
+      jitter->cached = 0;
+      break;
+    }
+    case GET_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      mem_t cell;
+      if (jit_cell(jitter, pc, &cell) != 0)
+        goto err_0;
+      aload(a, CELL_W, CACHE_REG, cell);
+      break;
+    }
+    case PUT_OP: {
+      if (jit_fetch(jitter, pc) != 0)
+        goto err_0;
+      acmpi(a, 0, jit_slot(0, TAG), VALUE_TYPE);
+      if (jit_exit(jitter, CC_NE, pc) != 0)
+        goto err_0;
+      mem_t cell;
+      if (jit_cell(jitter, pc, &cell) != 0)
+        goto err_0;
+      aload(a, CELL_W, RDX, jit_slot(0, CELL));
+      astore(a, CELL_W, cell, RDX);
+      aalui(a, 1, 5, TOP_REG, SLOT);
+      jitter->cached = 0;
+      break;
+    }
+    default: {
+      rerr_msg(&program->report, "unsupported opcode");
+      goto err_0;
+    }
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+static int jit_exit(jitter_t* jitter, const cc_e cc, const insn_t* pc)
+{
+  if (jitter->size == jitter->capacity) {
+    size_t capacity = jitter->capacity? jitter->capacity*2: BUFSIZ;
+    exit_t* bud = realloc(jitter->exits, capacity*sizeof(exit_t));
+    if (bud == NULL) {
+      rerr_msg(jitter->code.report, sys_msg());
+      goto err_0;
+    }
+    jitter->exits = bud;
+    jitter->capacity = capacity;
+  }
+
+  exit_t* exit = jitter->exits+jitter->size++;
+  exit->patch = ajcc(&jitter->code, cc);
+  exit->pc = pc;
+  exit->cached = jitter->cached;
+  return 0;
+err_0:
+  return -1;
+}
+
+static void jit_flush(jitter_t* jitter)
+{
+  if (!jitter->cached)
+    return;
+
+  asm_t* a = &jitter->code;
+  astorei(a, 0, jit_slot(-1, TAG), VALUE_TYPE);
+  astore(a, CELL_W, jit_slot(-1, CELL), CACHE_REG);
+  aalui(a, 1, 0, TOP_REG, SLOT);
+  jitter->cached = 0;
+}
+
+static int jit_fetch(jitter_t* jitter, const insn_t* pc)
+{
+  if (jitter->cached)
+    return 0;
+
+  asm_t* a = &jitter->code;
+  acmpi(a, 0, jit_slot(0, TAG), VALUE_TYPE);
+  if (jit_exit(jitter, CC_NE, pc) != 0)
+    goto err_0;
+  aload(a, CELL_W, CACHE_REG, jit_slot(0, CELL));
+  aalui(a, 1, 5, TOP_REG, SLOT);
+  jitter->cached = 1;
+  return 0;
+err_0:
+  return -1;
+}
+
+// with --trap-overflow the result is built in rdx, so the side exit still
+// finds the operands untouched and the interpreter reports the overflow
+static int jit_trap(jitter_t* jitter, const insn_t* pc)
+{
+  if (jit_exit(jitter, CC_O, pc) != 0)
+    goto err_0;
+  areg(&jitter->code, CELL_W, 0x89, RDX, CACHE_REG);
+  return 0;
+err_0:
+  return -1;
+}
+
+static mem_t jit_slot(const int depth, const int field)
+{
+  return (mem_t){TOP_REG, NOREG, 0, -(depth+1)*SLOT+field};
+}
+
+static mem_t jit_var(const int varadr, const int field)
+{
+  return (mem_t){VARS_REG, NOREG, 0, varadr*SLOT+field};
+}
+
+// sib scales stop at 8, wider slots pre-shift the index register
+static mem_t jit_index(asm_t* a, const reg_e base, const reg_e index, const int disp)
+{
+  if (SLOT_SHIFT > SIB_SHIFT) {
+    areg(a, 1, 0xc1, 4, index);
+    abyte(a, SLOT_SHIFT-SIB_SHIFT);
+  }
+  return (mem_t){base, index, SLOT_SHIFT > SIB_SHIFT? SIB_SHIFT: SLOT_SHIFT, disp};
+}
+
+// the cached top is the index, anything outside the heap is left to the
+// interpreter to report; the heap is an argument, so the code does not
+// care which interpreter runs it
+static int jit_cell(jitter_t* jitter, const insn_t* pc, mem_t* cell)
+{
+  asm_t* a = &jitter->code;
+  if (!CELL_W)
+    areg(a, 1, 0x63, CACHE_REG, CACHE_REG);
+  amem(a, 1, 0x3b, CACHE_REG, (mem_t){MEMORY_REG, NOREG, 0, offsetof(memory_t, size)});
+  if (jit_exit(jitter, CC_AE, pc) != 0)
+    goto err_0;
+  aload(a, 1, RCX, (mem_t){MEMORY_REG, NOREG, 0, offsetof(memory_t, data)});
+  *cell = (mem_t){RCX, CACHE_REG, CELL_W? 3: 2, 0};
+  return 0;
+err_0:
+  return -1;
+}
+
+static int areserve(asm_t* a)
+{
+  if (a->capacity-a->size < ASM_SLACK) {
+    size_t capacity = a->capacity? a->capacity*2: BUFSIZ;
+    unsigned char* bud = realloc(a->data, capacity);
+    if (bud == NULL) {
+      rerr_msg(a->report, sys_msg());
+      goto err_0;
+    }
+    a->data = bud;
+    a->capacity = capacity;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+static void abyte(asm_t* a, const int byte)
+{
+  a->data[a->size++] = byte;
+}
+
+static void aimm32(asm_t* a, const int32_t imm)
+{
+  memcpy(a->data+a->size, &imm, sizeof(imm));
+  a->size += sizeof(imm);
+}
+
+static void aimm64(asm_t* a, const uint64_t imm)
+{
+  memcpy(a->data+a->size, &imm, sizeof(imm));
+  a->size += sizeof(imm);
+}
+
+static void amem(asm_t* a, const int w, const int opcode, const int reg, const mem_t mem)
+{
+  int rex = w<<3 | (reg>>3)<<2 | (mem.base>>3);
+  if (mem.index != NOREG)
+    rex |= (mem.index>>3)<<1;
+  if (rex)
+    abyte(a, 0x40|rex);
+  if (opcode > 0xff)
+    abyte(a, opcode>>8);
+  abyte(a, opcode&0xff);
+
+  int mod = mem.disp == 0 && (mem.base&7) != RBP? 0: mem.disp >= -128 && mem.disp < 128? 1: 2;
+  if (mem.index != NOREG) {
+    abyte(a, mod<<6 | (reg&7)<<3 | 4);
+    abyte(a, mem.scale<<6 | (mem.index&7)<<3 | (mem.base&7));
+  }
+  else if ((mem.base&7) == RSP) {
+    abyte(a, mod<<6 | (reg&7)<<3 | 4);
+    abyte(a, 0x24);
+  }
+  else
+    abyte(a, mod<<6 | (reg&7)<<3 | (mem.base&7));
+
+  if (mod == 1)
+    abyte(a, mem.disp&0xff);
+  else if (mod == 2)
+    aimm32(a, mem.disp);
+}
+
+static void areg(asm_t* a, const int w, const int opcode, const int reg, const int rm)
+{
+  int rex = w<<3 | (reg>>3)<<2 | (rm>>3);
+  if (rex)
+    abyte(a, 0x40|rex);
+  if (opcode > 0xff)
+    abyte(a, opcode>>8);
+  abyte(a, opcode&0xff);
+  abyte(a, 3<<6 | (reg&7)<<3 | (rm&7));
+}
+
+static void aload(asm_t* a, const int w, const reg_e reg, const mem_t mem)
+{
+  amem(a, w, 0x8b, reg, mem);
+}
+
+static void astore(asm_t* a, const int w, const mem_t mem, const reg_e reg)
+{
+  amem(a, w, 0x89, reg, mem);
+}
+
+static void astorei(asm_t* a, const int w, const mem_t mem, const int32_t imm)
+{
+  amem(a, w, 0xc7, 0, mem);
+  aimm32(a, imm);
+}
+
+static void acmpi(asm_t* a, const int w, const mem_t mem, const int8_t imm)
+{
+  amem(a, w, 0x83, 7, mem);
+  abyte(a, imm&0xff);
+}
+
+static void amovi(asm_t* a, const int w, const reg_e reg, const int64_t imm)
+{
+  if (imm >= INT32_MIN && imm <= INT32_MAX) {
+    areg(a, w, 0xc7, 0, reg);
+    aimm32(a, imm);
+    return;
+  }
+  abyte(a, 0x48|(reg>>3));
+  abyte(a, 0xb8|(reg&7));
+  aimm64(a, imm);
+}
+
+static void aalui(asm_t* a, const int w, const int ext, const reg_e reg, const int32_t imm)
+{
+  if (imm >= -128 && imm < 128) {
+    areg(a, w, 0x83, ext, reg);
+    abyte(a, imm&0xff);
+    return;
+  }
+  areg(a, w, 0x81, ext, reg);
+  aimm32(a, imm);
+}
+
+static void acopy(asm_t* a, const mem_t dst, const mem_t src)
+{
+  for (int off = 0; off < SLOT; off += 8) {
+    mem_t from = src;
+    mem_t to = dst;
+    from.disp += off;
+    to.disp += off;
+    aload(a, 1, RDX, from);
+    astore(a, 1, to, RDX);
+  }
+}
+
+static void asetcc(asm_t* a, const cc_e cc, const reg_e reg)
+{
+  areg(a, 0, 0x0f90|cc, 0, reg);
+}
+
+static size_t ajcc(asm_t* a, const cc_e cc)
+{
+  abyte(a, 0x0f);
+  abyte(a, 0x80|cc);
+  size_t at = a->size;
+  aimm32(a, 0);
+  return at;
+}
+
+static size_t ajmp(asm_t* a)
+{
+  abyte(a, 0xe9);
+  size_t at = a->size;
+  aimm32(a, 0);
+  return at;
+}
+
+static void apatch(asm_t* a, const size_t at, const size_t target)
+{
+  int32_t rel = target-(at+4);
+  memcpy(a->data+at, &rel, sizeof(rel));
+}
+
+void jit_free(program_t* program)
+{
+  jit_t* jit = &program->jit;
+  if (jit->code != NULL)
+    munmap(jit->code, jit->length);
+  free(jit->blocks);
+  memset(jit, 0, sizeof(*jit));
+}
+
+#else
+
+int jit_compile(program_t* program)
+{
+  rerr_msg(&program->report, "jit is only available on x86-64");
+  return -1;
+}
+
+void jit_free(program_t* program)
+{
+}
+
+#endif
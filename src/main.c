@@ -1,1230 +1,1129 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
-#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vm.h"
 
 // misc
-static const char* sys_msg();
-static void err_msg(const char* fmt, ...);
-static char* loadfile(const char* filename);
-
-// token
-typedef enum token_e {
-  LCOMMENT = '{',
-  RCOMMENT = '}',
-  LCODE = '[',
-  RCODE = ']',
-  VARADR = 256,
-  VALUE = 257,
-  CHAR = 258,
-  CHARPREDICT = '\'',
-  ASSIGN = ':',
-  RVAL = ';',
-  APPLY = '!',
-  PLUS = '+',
-  MINUS = '-',
-  MULTIPLE = '*',
-  DIVIDE = '/',
-  NEGATE = '_',
-  ISEQUAL = '=',
-  ISGREATER = '>',
-  AND = '&',
-  OR = '|',
-  NOT = '~',
-  DUPLICATE = '$',
-  DELETE = '%',
-  SWAP = '\\',
-  ROT = '@',
-  PICK = 'O',
-  IF = '?',
-  WHILE = '#',
-  TOINT = '.',
-  QUOTE = '"',
-  TOCHAR = ',',
-  GETC = '^',
-  NEWLINE = '\n',
-  __TOKEN_BOUND__ = 300
-} token_e;
-typedef struct token_t {
-  token_e type;
-  const char* data;
+static void usage(const char* name);
+
+// source
+static program_t g_program;
+static vm_t g_vm;
+static const char* loadfile(const char* filename);
+static const char* loadstream(const int fd);
+static uint64_t hash(const char* data, const size_t size);
+
+
+// profile
+typedef struct pframe_t {
+  size_t entry;
+  uint64_t start;
+  uint64_t child;
+} pframe_t;
+typedef struct plambda_t {
+  int entry;
+  const token_t* first;
+  const token_t* last;
+  size_t active;
+  size_t calls;
+  uint64_t inclusive;
+  uint64_t exclusive;
+} plambda_t;
+typedef struct profile_t {
+  FILE* out;
+  size_t ops[__OPCODE_BOUND__];
+  plambda_t* lambdas;
+  pframe_t* frames;
   size_t size;
-
-  const char* head;
-  int line;
-} token_t;
-static void set_token(token_t* token, const token_e type, const char* data, const size_t size,
-               const char*head, const int line);
-static void token_err(const token_t* token);
-
-// type
-typedef enum type_e {
-  VARADR_TYPE,
-  VALUE_TYPE,
-  CODE_TYPE,
-  __TYPE_BOUND__
-} type_e;
-static const char* strtype(const type_e type);
-typedef enum boolean_e {
-  TRUE = -1,
-  FALSE = 0,
-  __BOOLEAN_BOUND__
-} boolean_e;
-typedef struct type_t {
-  type_e type;
-  union {
-    int value;
-    struct type_t* varadr;
-    struct {
-      token_t* first;
-      token_t* last;
-    } code;
-  } data;
-} type_t;
-static void type_err(const type_t* data, const type_e type);
-static type_t* tnew();
-static type_t* tnew_value(int value);
-static type_t* tnew_varadr(type_t* varadr);
-static type_t* tnew_code(token_t* first, token_t* last);
-static void tfree(type_t* type);
-static type_t* tcopy(const type_t* from, type_t* to);
-static void tshow(const type_t* self);
-
-// global stack
-typedef struct stack_t {
-  type_t* data;
-  struct stack_t* to;
-} stack_t;
-static stack_t* g_top = NULL;
-static int spush(type_t* data);
-static type_t* spop();
-static int sisempty();
-static void sclear();
-static type_t* spick(const int index);
-
-// global 
-#define VARADDR_SIZE 26
-static type_t g_varadr[VARADDR_SIZE];
-static void varadr_init();
-
-// lexer
-static int lexer(char* foo, token_t** tokens, size_t* size);
-
-// parser
-typedef int isok_i(token_t*);
-typedef token_t* action_i(token_t*, token_t*);
-static token_t* parse_linear(token_t* first, token_t* last, isok_i* isok, action_i* action);
-static token_t* parse_tree(token_t* first, token_t* last, int open, int close, action_i* action);
-static int parse(token_t* first, token_t* last);
-
-// isok
-static int pass(token_t* token);
-static int is_not_quote(token_t* token);
-
-// action
-static token_t* do_nothing(token_t* first, token_t* last);
-
-static token_t* do_code(token_t* first, token_t* last);
-static token_t* do_varadr(token_t* first, token_t* last);
-static token_t* do_value(token_t* first, token_t* last);
-static token_t* do_char(token_t* first, token_t* last);
-
-static token_t* do_assign(token_t* first, token_t* last);
-static token_t* do_rval(token_t* first, token_t* last);
-
-static token_t* do_apply(token_t* first, token_t* last);
-
-static token_t* do_binary(token_t* first, token_t* last);
-
-static token_t* do_unary(token_t* first, token_t* last);
-
-static token_t* do_duplicate(token_t* first, token_t* last);
-static token_t* do_delete(token_t* first, token_t* last);
-static token_t* do_swap(token_t* first, token_t* last);
-static token_t* do_rot(token_t* first, token_t* last);
-static token_t* do_pick(token_t* first, token_t* last);
-
-static token_t* do_if(token_t* first, token_t* last);
-static token_t* do_while(token_t* first, token_t* last);
-
-static token_t* do_toint(token_t* first, token_t* last);
-static token_t* do_quote(token_t* first, token_t* last);
-static token_t* do_tochar(token_t* first, token_t* last);
-
-static token_t* do_getc(token_t* first, token_t* last);
+  size_t capacity;
+  const insn_t* last;
+  opcode_e op;
+} profile_t;
+static profile_t g_profile;
+#define PROFILE_EXCERPT 24
+static inline uint64_t pclock();
+static int profopen(const char* filename);
+static int profhook(vm_t* vm, const insn_t* pc);
+static int profenter(const size_t entry, const uint64_t now);
+static void profleave(const uint64_t now);
+static int profcmp(const void* lhs, const void* rhs);
+static int opcmp(const void* lhs, const void* rhs);
+static void profreport();
+static void profclose();
+
+// trace
+typedef struct record_t {
+  uint32_t at;
+  uint8_t op;
+  uint8_t type;
+  uint16_t reserved;
+  uint32_t depth;
+  cell_t top;
+} record_t;
+typedef struct theader_t {
+  char magic[8];
+  uint32_t record;
+  uint32_t ops;
+  uint64_t length;
+  uint64_t hash;
+  uint64_t total;
+} theader_t;
+typedef struct trace_t {
+  int fd;
+  int wrap;
+  record_t* data;
+  size_t size;
+  size_t capacity;
+  uint64_t total;
+} trace_t;
+#define TRACE_MAGIC "dftrace1"
+#define TRACE_SIZE (1<<16)
+static trace_t g_trace = {-1, 0, NULL, 0, 0, 0};
+static int topen(const char* filename, const size_t ring);
+static void theader(theader_t* header);
+static int twrite(const void* data, size_t size);
+static int tflush();
+static int thook(vm_t* vm, const insn_t* pc);
+static int tclose();
+static int tdecode(const char* filename);
+static int hooks(vm_t* vm, const insn_t* pc);
+
+// cache
+typedef struct cheader_t {
+  char magic[8];
+  uint64_t format;
+  uint32_t insn;
+  uint32_t token;
+  uint64_t length;
+  uint64_t hash;
+  uint64_t size;
+  uint64_t strings;
+  uint64_t sum;
+} cheader_t;
+#define CACHE_MAGIC "dfcache2"
+// bump when an instruction's arg or the cached layout changes meaning,
+// renumbered or renamed opcodes change the format on their own
+#define CACHE_FORMAT 1
+#define CACHE_SUFFIX "c"
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+static int cpath(const char* filename, const char* dir, char* path);
+static uint64_t cformat();
+static void cheader(cheader_t* header);
+static int cload(const char* path);
+static int csave(const char* path);
 
 int main(int argc, char* argv[])
 {
-  char* foo = loadfile(argv[1]);
-  if (foo == NULL) {
+  static const struct option options[] = {
+    {"rstack", required_argument, NULL, 'r'},
+    {"dump", no_argument, NULL, 'd'},
+    {"jit", no_argument, NULL, 'j'},
+    {"emit-c", no_argument, NULL, 'c'},
+    {"input", required_argument, NULL, 'i'},
+    {"profile", optional_argument, NULL, 'p'},
+    {"trace", required_argument, NULL, 't'},
+    {"trace-ring", required_argument, NULL, 'T'},
+    {"decode", required_argument, NULL, 'D'},
+    {"cache", optional_argument, NULL, 'C'},
+    {"trap-overflow", no_argument, NULL, 'o'},
+    {"memory", required_argument, NULL, 'm'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int dump = 0;
+  int jit = 0;
+  int emitc = 0;
+  const char* input = NULL;
+  int profile = 0;
+  const char* report = NULL;
+  const char* trace = NULL;
+  size_t ring = 0;
+  const char* decode = NULL;
+  int cache = 0;
+  const char* cachedir = NULL;
+  size_t memory = 0;
+  int opt;
+  vinit(&g_vm);
+  while ((opt = getopt_long(argc, argv, "r:djci:p::t:T:D:C::om:h", options, NULL)) != -1)
+    switch (opt) {
+      case 'r': {
+        char* end;
+        long limit = strtol(optarg, &end, 10);
+        if (*end || limit <= 0) {
+          err_msg("invalid return stack limit %s", optarg);
+          goto err_0;
+        }
+        g_vm.rstack.limit = limit;
+        break;
+      }
+      case 'd': {
+        dump = 1;
+        break;
+      }
+      case 'j': {
+        jit = 1;
+        break;
+      }
+      case 'c': {
+        emitc = 1;
+        break;
+      }
+      case 'i': {
+        input = optarg;
+        break;
+      }
+      case 'p': {
+        profile = 1;
+        report = optarg;
+        break;
+      }
+      case 't': {
+        trace = optarg;
+        break;
+      }
+      case 'T': {
+        char* end;
+        long size = strtol(optarg, &end, 10);
+        if (*end || size <= 0) {
+          err_msg("invalid trace ring size %s", optarg);
+          goto err_0;
+        }
+        ring = size;
+        break;
+      }
+      case 'D': {
+        decode = optarg;
+        break;
+      }
+      case 'C': {
+        cache = 1;
+        cachedir = optarg;
+        break;
+      }
+      case 'o': {
+        g_program.trap = 1;
+        break;
+      }
+      case 'm': {
+        char* end;
+        long long size = strtoll(optarg, &end, 10);
+        if (*end || size <= 0 || size > SIZE_MAX/sizeof(cell_t)) {
+          err_msg("invalid memory size %s", optarg);
+          goto err_0;
+        }
+        memory = size;
+        break;
+      }
+      case 'h': {
+        usage(argv[0]);
+        return 0;
+      }
+      default: {
+        usage(argv[0]);
+        goto err_0;
+      }
+    }
+
+  // with no file given the program comes from stdin, unless that is a terminal
+  if (optind < argc-1 || (optind == argc && isatty(STDIN_FILENO))) {
+    usage(argv[0]);
+    goto err_0;
+  }
+
+  const char* filename = optind < argc? argv[optind]: "-";
+  if (loadfile(filename) == NULL) {
     err_msg("load file failed");
     goto err_0;
   }
 
-  token_t* tokens;
-  size_t size;
-  if (lexer(foo, &tokens, &size) != 0) {
-    err_msg("lexer failed");
+  if (decode) {
+    int status = tdecode(decode);
+    pfree(&g_program);
+    return status;
+  }
+
+  // a cached program points into its own copy of the tokens
+  char path[PATH_MAX];
+  int cached = cache && cpath(filename, cachedir, path) == 0;
+  if (!cached || cload(path) != 0) {
+    if (pcompile(&g_program) != 0)
+      goto err_1;
+
+    if (cached)
+      csave(path);
+  }
+
+  if (dump || emitc) {
+    int status = 0;
+    if (dump)
+      pdump(&g_program);
+    else
+      status = cgen(&g_program, memory, g_vm.rstack.limit, stdout);
+    pfree(&g_program);
+    return status;
+  }
+
+  if (profile && profopen(report) != 0) {
+    err_msg("open profile failed");
     goto err_1;
   }
 
-  varadr_init();
-  if (parse(tokens, tokens+size) != 0) {
+  if (trace && topen(trace, ring) != 0) {
+    err_msg("open trace failed");
+    goto err_1;
+  }
+  g_vm.hook = profile && trace? hooks: profile? profhook: trace? thook: NULL;
+
+  if (mopen(&g_vm, memory) != 0) {
+    err_msg("open memory failed");
+    goto err_1;
+  }
+
+  if (jit && jit_compile(&g_program) != 0) {
+    err_msg("jit failed");
+    goto err_1;
+  }
+
+  if (input && iopen(&g_vm, input) != 0) {
+    err_msg("open input failed");
+    goto err_1;
+  }
+
+  g_vm.program = &g_program;
+  g_vm.insns = g_program.insns;
+  varadr_init(&g_vm);
+  if (execute(&g_vm, g_program.insns) != 0) {
     err_msg("interpret failed");
-    goto err_3;
+    goto err_2;
+  }
+
+  if (oflush(&g_vm) != 0) {
+    err_msg("flush failed");
+    goto err_2;
   }
 
-  if (!sisempty()) {
+  if (!sisempty(&g_vm)) {
     err_msg("stack is not empty");
-    goto err_3;
+    goto err_2;
   }
 
-  free(tokens);
-  free(foo);
+  if (tclose() != 0) {
+    err_msg("close trace failed");
+    goto err_2;
+  }
+
+  profreport();
+  rclear(&g_vm);
+  sclear(&g_vm);
+  iclose(&g_vm);
+  profclose();
+  mfree(&g_vm);
+  pfree(&g_program);
   return 0;
-err_3:
-    sclear();
 err_2:
-  free(tokens);
+  profreport();
+  sclear(&g_vm);
+  iclose(&g_vm);
 err_1:
-  free(foo);
+  tclose();
+  profclose();
+  mfree(&g_vm);
+  pfree(&g_program);
 err_0:
   return -1;
 }
 
-static const char* sys_msg()
+static void usage(const char* name)
 {
-  return strerror(errno);
+  fprintf(stderr,
+      "usage: %s [options] [<src-with-df-suffix> | -]\n"
+      "  -r, --rstack=N        limit the return stack to N frames (default %d)\n"
+      "  -d, --dump            print the optimized bytecode instead of running it\n"
+      "  -j, --jit             compile straight-line code to native x86-64 code\n"
+      "  -c, --emit-c          print a standalone C translation instead of running it\n"
+      "  -i, --input=FILE      read ^ from FILE instead of stdin\n"
+      "  -p, --profile[=FILE]  report opcode and lambda counts and times to stderr or FILE\n"
+      "  -t, --trace=FILE      record every executed instruction to FILE\n"
+      "  -T, --trace-ring=N    keep only the last N trace records\n"
+      "  -D, --decode=TRACE    print TRACE against the source instead of running it\n"
+      "  -C, --cache[=DIR]     reuse the compiled program from <src>c or DIR\n"
+      "  -o, --trap-overflow   fail on arithmetic overflow instead of wrapping\n"
+      "  -m, --memory=N        give G and P a heap of N zeroed cells\n"
+      "  -h, --help            show this message\n",
+      name, RSTACK_LIMIT);
 }
 
-static void err_msg(const char* fmt, ...)
+static const char* loadfile(const char* filename)
 {
-  va_list ap;
-  va_start(ap, fmt);
-  fprintf(stderr, "\e[31m");
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\e[0m\n");
-  va_end(ap);
-}
+  if (strcmp(filename, "-") == 0)
+    return loadstream(STDIN_FILENO);
 
-static char* loadfile(const char* filename)
-{
-  FILE* file = fopen(filename, "r");
-  if (file == NULL) {
-    err_msg(sys_msg());
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    err_msg("%s: %s", filename, sys_msg());
     goto err_0;
   }
 
-  if (fseek(file, 0, SEEK_END) == -1) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
     err_msg(sys_msg());
     goto err_1;
   }
-  long size = ftell(file);
-  rewind(file);
 
-  char* foo = calloc(size+1, 1);
-  if (foo == NULL) {
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    const char* foo = loadstream(fd);
+    close(fd);
+    return foo;
+  }
+
+  // reserve one byte past the file so the source stays NUL terminated: the
+  // kernel zero fills the tail of the last file page, and a file ending on
+  // a page boundary is followed by a spare anonymous page
+  long page = sysconf(_SC_PAGESIZE);
+  size_t length = (st.st_size+page)/page*page;
+  char* foo = mmap(NULL, length, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (foo == MAP_FAILED) {
     err_msg(sys_msg());
     goto err_1;
   }
 
-  if (fread(foo, 1, size, file) != size) {
+  if (mmap(foo, st.st_size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
     err_msg(sys_msg());
-    goto err_1;
+    goto err_2;
   }
-  foo[size] = '\0';
 
-  fclose(file);
+  close(fd);
+  g_program.source.data = foo;
+  g_program.source.length = length;
   return foo;
+err_2:
+  munmap(foo, length);
 err_1:
-  fclose(file);
+  close(fd);
 err_0:
   return NULL;
 }
 
-static const char* strtype(const type_e type)
+static const char* loadstream(const int fd)
 {
-  static const char* strs[] = {
-    "varadr",
-    "value",
-    "function",
-    "__TYPE_UNDEFINE__"
-  };
-  return strs[type];
-}
-
-static void type_err(const type_t* data, const type_e type)
-{
-  err_msg("expect %s not %s", strtype(type), strtype(data->type));
-}
-
-static void set_token(token_t* token, const token_e type, const char* data, const size_t size,
-               const char*head, const int line)
-{
-  token->type = type;
-  token->data = data;
-  token->size = size;
-  token->head = head;
-  token->line = line;
-}
-
-static void token_err(const token_t* token)
-{
-  char prefix[BUFSIZ];
-  sprintf(prefix, "%d:%d:", token->line, (int)(token->data-token->head+1));
-  err_msg("%s from here", prefix);
-
-  char foo[BUFSIZ];
-  int len = token->data-token->head;
-  snprintf(foo, len+token->size+1, "%s", token->head);
-  err_msg("%s %s", prefix, foo);
-
-  for (int i = 0; i < len; i++)
-    foo[i] = isspace(token->head[i])? token->head[i]: ' ';
-  foo[len] = '^';
-  foo[len+1] = '\0';
-  err_msg("%s %s", prefix, foo);
-}
-
-static type_t* tnew()
-{
-  type_t* bud = malloc(sizeof(type_t));
-  if (bud == NULL) {
+  size_t size = 0;
+  size_t capacity = BUFSIZ;
+  char* foo = malloc(capacity);
+  if (foo == NULL) {
     err_msg(sys_msg());
     goto err_0;
   }
-  return bud;
-err_0:
-  return NULL;
-}
-
-static type_t* tnew_value(int value)
-{
-  type_t* bud = tnew();
-  if (bud == NULL)
-    goto err_0;
 
-  bud->type = VALUE_TYPE;
-  bud->data.value = value;
-  return bud;
-err_0:
-  return NULL;
-}
+  for (;;) {
+    if (capacity-size < BUFSIZ) {
+      capacity *= 2;
+      char* bud = realloc(foo, capacity);
+      if (bud == NULL) {
+        err_msg(sys_msg());
+        goto err_1;
+      }
+      foo = bud;
+    }
 
-static type_t* tnew_varadr(type_t* varadr)
-{
-  type_t* bud = tnew();
-  if (bud == NULL)
-    goto err_0;
+    ssize_t count = read(fd, foo+size, capacity-size-1);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0) {
+      err_msg(sys_msg());
+      goto err_1;
+    }
+    if (count == 0)
+      break;
+    size += count;
+  }
+  foo[size] = '\0';
 
-  bud->type = VARADR_TYPE;
-  bud->data.varadr = varadr;
-  return bud;
+  g_program.source.data = foo;
+  g_program.source.length = 0;
+  return foo;
+err_1:
+  free(foo);
 err_0:
   return NULL;
 }
 
-static type_t* tnew_code(token_t* first, token_t* last)
+// FNV-1a taken a word at a time, folding the high half back so every
+// input bit reaches the low bits too
+static uint64_t hash(const char* data, const size_t size)
 {
-  type_t* bud = tnew();
-  if (bud == NULL)
-    goto err_0;
-
-  bud->type = CODE_TYPE;
-  bud->data.code.first = first;
-  bud->data.code.last = last;
-  return bud;
-err_0:
-  return NULL;
+  uint64_t h = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i+sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data+i, sizeof(word));
+    h = (h^word)*0x100000001b3ull;
+    h ^= h>>29;
+  }
+  for (; i < size; i++)
+    h = (h^(unsigned char)data[i])*0x100000001b3ull;
+  return h;
 }
 
-static void tfree(type_t* type)
+static inline uint64_t pclock()
 {
-  free(type);
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec*1000000000+now.tv_nsec;
+#endif
 }
 
-static type_t* tcopy(const type_t* from, type_t* to)
+static int profopen(const char* filename)
 {
-  if (to == NULL) {
-    to = malloc(sizeof(type_t));
-    if (to == NULL) {
-      err_msg(sys_msg());
+  g_profile.out = stderr;
+  if (filename) {
+    g_profile.out = fopen(filename, "w");
+    if (g_profile.out == NULL) {
+      err_msg("%s: %s", filename, sys_msg());
       goto err_0;
     }
   }
-  return memcpy(to, from, sizeof(type_t));
-err_0:
-  return NULL;
-}
 
-static void tshow(const type_t* self)
-{
-  const char* type_str = strtype(self->type);
-  switch (self->type) {
-    case VALUE_TYPE: {
-      err_msg("%s %d", type_str, self->data.value);
-      break;
-    }
-    case VARADR_TYPE: {
-      err_msg("%s %c", type_str, self->data.varadr-g_varadr+'a');
-      break;
-    }
-    case CODE_TYPE: {
-      err_msg("%s start", type_str);
-      token_err(self->data.code.first);
-      err_msg("%s end", type_str);
-      break;
-    }
-    default: {
-    }
+  g_profile.lambdas = calloc(g_program.size, sizeof(plambda_t));
+  if (g_profile.lambdas == NULL) {
+    err_msg(sys_msg());
+    goto err_1;
   }
-}
 
-static int spush(type_t* data)
-{
-  stack_t* bud = malloc(sizeof(stack_t));
-  if (bud == NULL) {
-    err_msg(sys_msg());
-    goto err_0;
+  // lambda bodies start right after their CODE, take them before the jit
+  // patches any of it
+  g_profile.lambdas[0].entry = 1;
+  for (size_t i = 0; i+1 < g_program.size; i++) {
+    const insn_t* code = g_program.insns+i;
+    if (code->op != CODE_OP)
+      continue;
+
+    plambda_t* lambda = g_profile.lambdas+i+1;
+    lambda->entry = 1;
+    lambda->first = code->token;
+    lambda->last = g_program.insns[code->arg-1].token;
   }
 
-  bud->data = data;
-  bud->to = g_top;
-  g_top = bud;
   return 0;
+err_1:
+  if (filename)
+    fclose(g_profile.out);
+  g_profile.out = NULL;
 err_0:
   return -1;
 }
 
-static type_t* spop()
+// runs before every instruction, so a frame is entered when control lands
+// on a lambda body and left when its RET is about to run
+static int profhook(vm_t* vm, const insn_t* pc)
 {
-  if (sisempty()) {
-    err_msg("stack underflow");
-    goto err_0;
+  g_profile.ops[pc->op]++;
+
+  const insn_t* last = g_profile.last;
+  const opcode_e op = g_profile.op;
+  g_profile.last = pc;
+  g_profile.op = pc->op;
+
+  size_t entry = pc-g_program.insns;
+  // a jit block that bails re-runs its first instruction in place
+  if (!g_profile.lambdas[entry].entry || (pc == last && op == JIT_OP)) {
+    if (pc->op == RET_OP)
+      profleave(pclock());
+    return 0;
   }
 
-  type_t* data = g_top->data;
-  stack_t* old = g_top;
-  g_top = g_top->to;
-  free(old);
-  return data;
-err_0:
-  return NULL;
-}
-
-static int sisempty()
-{
-  return g_top == NULL;
+  uint64_t now = pclock();
+  switch (op) {
+    case TAILAPPLY_OP:
+    case QTAILAPPLY_OP:
+    case TAILIF_OP:
+    case QTAILIF_OP:
+    case TAILCALLVAR_OP: {
+      profleave(now);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+  if (profenter(entry, now) != 0)
+    return -1;
+  // an empty lambda leaves on its entry
+  if (pc->op == RET_OP)
+    profleave(now);
+  return 0;
 }
 
-static void sclear()
+static int profenter(const size_t entry, const uint64_t now)
 {
-  while (!sisempty()) {
-    type_t* data = spop();
-    err_msg("pop:");
-    tshow(data);
-    tfree(data);
+  if (g_profile.size == g_profile.capacity) {
+    size_t capacity = g_profile.capacity? g_profile.capacity*2: BUFSIZ;
+    pframe_t* bud = realloc(g_profile.frames, capacity*sizeof(pframe_t));
+    if (bud == NULL) {
+      err_msg(sys_msg());
+      goto err_0;
+    }
+    g_profile.frames = bud;
+    g_profile.capacity = capacity;
   }
-}
 
-static type_t* spick(const int index)
-{
-  stack_t* found = g_top;
-  for (int i = 0; found != NULL && i < index; i++)
-    found = found->to;
+  pframe_t* frame = g_profile.frames+g_profile.size++;
+  frame->entry = entry;
+  frame->start = now;
+  frame->child = 0;
 
-  if (found == NULL) {
-    err_msg("you pick too deep");
-    goto err_0;
-  }
-  return found->data;
+  plambda_t* lambda = g_profile.lambdas+entry;
+  lambda->calls++;
+  lambda->active++;
+  return 0;
 err_0:
-  return NULL;
+  return -1;
 }
 
-static void varadr_init()
+static void profleave(const uint64_t now)
 {
-  g_varadr[0].type = VALUE_TYPE;
-  g_varadr[0].data.value = 0;
-  for (int i = 1; i < VARADDR_SIZE; i++)
-    g_varadr[i].type = __TYPE_BOUND__;
+  if (g_profile.size == 0)
+    return;
+
+  const pframe_t* frame = g_profile.frames+--g_profile.size;
+  uint64_t elapsed = now-frame->start;
+  plambda_t* lambda = g_profile.lambdas+frame->entry;
+  lambda->exclusive += elapsed-frame->child;
+  // recursive activations are already inside the outermost one
+  if (--lambda->active == 0)
+    lambda->inclusive += elapsed;
+  if (g_profile.size > 0)
+    g_profile.frames[g_profile.size-1].child += elapsed;
 }
 
-static int lexer(char* foo, token_t** tokens, size_t* size)
+static int profcmp(const void* lhs, const void* rhs)
 {
-  token_t* bud = calloc(strlen(foo)+1, sizeof(token_t));
-  if (bud == NULL) {
-    err_msg(sys_msg());
-    goto err_0;
-  }
-
-  char* head = foo;
-  int line = 1;
-  size_t size_ = 0;
-  while (*foo)
-    if (isspace(*foo)) {
-      if (*foo == NEWLINE) {
-        head = foo+1;
-        line++;
-      }
-      set_token(bud+size_++, *foo, foo, 1, head, line);
-      foo++;
-    }
-    else if (islower(*foo)) {
-      set_token(bud+size_++, VARADR, foo, 1, head, line);
-      foo++;
-    }
-    else if (isdigit(*foo)) {
-      char* start = foo;
-      while (*foo && isdigit(*foo))
-        foo++;
-      set_token(bud+size_++, VALUE, start, foo-start, head, line);
-    }
-    else if (*foo == CHARPREDICT) {
-      foo++;
-      set_token(bud+size_++, CHAR, foo, 1, head, line);
-      if (*foo)
-        foo++;
-    }
-    else {
-      set_token(bud+size_++, *foo, foo, 1, head, line);
-      foo++;
-    }
-
-  set_token(bud+size_, __TOKEN_BOUND__, foo, 0, head, line);
-  *tokens = bud;
-  *size = size_;
-  return 0;
-err_0:
-  return -1;
+  const plambda_t* l = g_profile.lambdas+*(const size_t*)lhs;
+  const plambda_t* r = g_profile.lambdas+*(const size_t*)rhs;
+  if (l->exclusive != r->exclusive)
+    return l->exclusive < r->exclusive? 1: -1;
+  return l->calls < r->calls? 1: l->calls > r->calls? -1: 0;
 }
 
-static token_t* parse_linear(token_t* first, token_t* last, isok_i* isok, action_i* action)
+static int opcmp(const void* lhs, const void* rhs)
 {
-  token_t* it = first;
-  while (it < last && isok(it))
-    it++;
-  return action(first, it);
+  size_t l = g_profile.ops[*(const opcode_e*)lhs];
+  size_t r = g_profile.ops[*(const opcode_e*)rhs];
+  return l < r? 1: l > r? -1: 0;
 }
 
-static token_t* parse_tree_aux(token_t* first, token_t* last, int down, int up)
+static void profreport()
 {
-  token_t* it = first;
-  while (it < last && it->type != up)
-    if (it->type == down) {
-      it = parse_tree_aux(it+1, last, down, up);
-      if (it == NULL)
-        return NULL;
-    }
-    else 
-      it++;
+  FILE* out = g_profile.out;
+  if (out == NULL)
+    return;
 
-  if (it->type != up) {
-    err_msg("missing matched %c", up);
-    token_err(first-1);
-    return NULL;
-  }
-  return it+1;
-}
+  uint64_t now = pclock();
+  while (g_profile.size > 0)
+    profleave(now);
 
-static token_t* parse_tree(token_t* first, token_t* last, int down, int up, action_i* action)
-{
-  last = parse_tree_aux(first, last, down, up);
-  if (last == NULL)
-    return NULL;
+  size_t total = 0;
+  for (int i = 0; i < __OPCODE_BOUND__; i++)
+    total += g_profile.ops[i];
 
-  return action(first, last-1);
-}
+  size_t* entries = malloc(g_program.size*sizeof(size_t));
+  if (entries == NULL) {
+    err_msg(sys_msg());
+    return;
+  }
 
-static int parse(token_t* first, token_t* last)
-{
-  while (first < last) {
-    if (isspace(first->type)) {
-      first++;
-      continue;
+  size_t count = 0;
+  uint64_t ticks = 0;
+  for (size_t i = 0; i < g_program.size; i++)
+    if (g_profile.lambdas[i].calls > 0) {
+      entries[count++] = i;
+      ticks += g_profile.lambdas[i].exclusive;
     }
-
-    token_t* save = first;
-    switch (first->type) {
-      case LCOMMENT: {
-        first = parse_tree(first+1, last, LCOMMENT, RCOMMENT, do_nothing);
-        break;
-      }
-      case RCOMMENT: {
-        err_msg("missing match {");
-        first = NULL;
-        break;
-      }
-      case LCODE: {
-        first = parse_tree(first+1, last, LCODE, RCODE, do_code);
-        break;
-      }
-      case RCODE: {
-        err_msg("missing match [");
-        first = NULL;
-        break;
-      }
-      case VARADR: {
-        first = parse_linear(first, first+1, pass, do_varadr);
-        break;
-      }
-      case VALUE: {
-        first = parse_linear(first, first+1, pass, do_value);
-        break;
-      }
-      case CHAR: {
-        first = parse_linear(first, first+1, pass, do_char);
-        break;
-      }
-      case ASSIGN: {
-        first = parse_linear(first, first+1, pass, do_assign);
-        break;
-      }
-      case RVAL: {
-        first = parse_linear(first, first+1, pass, do_rval);
-        break;
-      }
-      case APPLY: {
-        first = parse_linear(first, first+1, pass, do_apply);
-        break;
-      }
-      case PLUS:
-      case MINUS:
-      case MULTIPLE:
-      case DIVIDE:
-      case ISEQUAL:
-      case ISGREATER:
-      case AND:
-      case OR: {
-        first = parse_linear(first, first+1, pass, do_binary);
-        break;
-      }
-      case NEGATE:
-      case NOT: {
-        first = parse_linear(first, first+1, pass, do_unary);
-        break;
-      }
-      case DUPLICATE: {
-        first = parse_linear(first, first+1, pass, do_duplicate);
-        break;
-      }
-      case DELETE: {
-        first = parse_linear(first, first+1, pass, do_delete);
-        break;
-      }
-      case SWAP: {
-        first = parse_linear(first, first+1, pass, do_swap);
-        break;
-      }
-      case ROT: {
-        first = parse_linear(first, first+1, pass, do_rot);
-        break;
-      }
-      case PICK: {
-        first = parse_linear(first, first+1, pass, do_pick);
-        break;
-      }
-      case IF: {
-        first = parse_linear(first, first+1, pass, do_if);
-        break;
-      }
-      case WHILE: {
-        first = parse_linear(first, first+1, pass, do_while);
-        break;
-      }
-      case TOINT: {
-        first = parse_linear(first, first+1, pass, do_toint);
-        break;
-      }
-      case QUOTE: {
-        first = parse_linear(first+1, last, is_not_quote, do_quote);
-        break;
-      }
-      case TOCHAR: {
-        first = parse_linear(first, first+1, pass, do_tochar);
-        break;
-      }
-      case GETC: {
-        first = parse_linear(first, first+1, pass, do_getc);
-        break;
-      }
-      default: {
-        err_msg("unknown token");
-        first = NULL;
-      }
+  qsort(entries, count, sizeof(size_t), profcmp);
+
+  fprintf(out, "%zu instructions, %llu ticks\n", total, (unsigned long long)ticks);
+  fprintf(out, "%12s %14s %14s %6s  %s\n",
+      "calls", "inclusive", "exclusive", "self", "lambda");
+  for (size_t i = 0; i < count; i++) {
+    const plambda_t* lambda = g_profile.lambdas+entries[i];
+    fprintf(out, "%12zu %14llu %14llu %5.1f%%  ",
+        lambda->calls,
+        (unsigned long long)lambda->inclusive,
+        (unsigned long long)lambda->exclusive,
+        ticks? 100.0*lambda->exclusive/ticks: 0.0);
+    if (lambda->first == NULL) {
+      fprintf(out, "main\n");
+      continue;
     }
 
-    if (first == NULL) {
-      token_err(save);
-      goto err_0;
-    }
+    const char* data = tdata(&g_program, lambda->first);
+    const char* end = tdata(&g_program, lambda->last)+1;
+    const char* head;
+    size_t line = lfind(&g_program, data, &head);
+    fprintf(out, "%zu:%d: ", line+1, (int)(data-head+1));
+    for (int j = 0; j < PROFILE_EXCERPT && data+j < end; j++)
+      fputc(isspace(data[j])? ' ': data[j], out);
+    fprintf(out, "%s\n", end-data > PROFILE_EXCERPT? "...": "");
   }
-  return 0;
-err_0:
-  return -1;
+  free(entries);
+
+  opcode_e ops[__OPCODE_BOUND__];
+  for (int i = 0; i < __OPCODE_BOUND__; i++)
+    ops[i] = i;
+  qsort(ops, __OPCODE_BOUND__, sizeof(opcode_e), opcmp);
+
+  fprintf(out, "%12s %6s  %s\n", "count", "share", "opcode");
+  for (int i = 0; i < __OPCODE_BOUND__ && g_profile.ops[ops[i]] > 0; i++)
+    fprintf(out, "%12zu %5.1f%%  %s\n",
+        g_profile.ops[ops[i]],
+        100.0*g_profile.ops[ops[i]]/total,
+        stropcode(ops[i]));
+  fflush(out);
 }
 
-static int pass(token_t* token)
+static void profclose()
 {
-  return 1;
+  if (g_profile.out && g_profile.out != stderr)
+    fclose(g_profile.out);
+  free(g_profile.lambdas);
+  free(g_profile.frames);
+  g_vm.hook = NULL;
+  memset(&g_profile, 0, sizeof(g_profile));
 }
 
-static token_t* do_nothing(token_t* first, token_t* last)
+static int topen(const char* filename, const size_t ring)
 {
-  return last+1;
-}
-
-static token_t* do_code(token_t* first, token_t* last)
-{
-  type_t* data = tnew_code(first, last);
-  if (data == NULL) 
+  g_trace.fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (g_trace.fd < 0) {
+    err_msg("%s: %s", filename, sys_msg());
     goto err_0;
+  }
 
-  if (spush(data) != 0)
+  g_trace.wrap = ring > 0;
+  g_trace.capacity = ring > 0? ring: TRACE_SIZE;
+  g_trace.data = calloc(g_trace.capacity, sizeof(record_t));
+  if (g_trace.data == NULL) {
+    err_msg(sys_msg());
     goto err_1;
-  return last+1;
+  }
+
+  // the header is written again with the final count on close
+  theader_t header;
+  theader(&header);
+  if (twrite(&header, sizeof(header)) != 0)
+    goto err_2;
+  return 0;
+err_2:
+  free(g_trace.data);
+  g_trace.data = NULL;
 err_1:
-  tfree(data);
+  close(g_trace.fd);
+  g_trace.fd = -1;
 err_0:
-  return NULL;
+  return -1;
 }
 
-static token_t* do_varadr(token_t* first, token_t* last)
+static void theader(theader_t* header)
 {
-  type_t* data = tnew_varadr(g_varadr+first->data[0]-'a');
-  if (data == NULL)
-    goto err_0;
-
-  if (spush(data) != 0)
-    goto err_1;
-  return last;
-err_1:
-  tfree(data);
-err_0:
-  return NULL;
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->record = sizeof(record_t);
+  header->ops = __OPCODE_BOUND__;
+  header->length = strlen(g_program.source.data);
+  header->hash = hash(g_program.source.data, header->length);
+  header->total = g_trace.total;
 }
 
-static token_t* do_value(token_t* first, token_t* last)
+static int twrite(const void* data, size_t size)
 {
-  int value = 0;
-  for (int i = 0; i < first->size; i++)
-    value = value*10+first->data[i]-'0';
-
-  type_t* data = tnew_value(value);
-  if (data == NULL)
-    goto err_0;
-
-  if (spush(data) != 0)
-    goto err_1;
-  return last;
-err_1:
-  tfree(data);
+  const char* it = data;
+  while (size > 0) {
+    ssize_t n = write(g_trace.fd, it, size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      err_msg("trace: %s", sys_msg());
+      goto err_0;
+    }
+    it += n;
+    size -= n;
+  }
+  return 0;
 err_0:
-  return NULL;
+  return -1;
 }
 
-static token_t* do_char(token_t* first, token_t* last)
+static int tflush()
 {
-  type_t* data = tnew_value(first->data[0]);
-  if (data == NULL)
+  if (twrite(g_trace.data, g_trace.size*sizeof(record_t)) != 0)
     goto err_0;
-
-  if (spush(data) != 0)
-    goto err_1;
-  return last;
-err_1:
-  tfree(data);
+  g_trace.size = 0;
+  return 0;
 err_0:
-  return NULL;
+  return -1;
 }
 
-static token_t* do_assign(token_t* first, token_t* last)
+static int thook(vm_t* vm, const insn_t* pc)
 {
-  type_t* lval = spop();
-  if (lval == NULL)
-    goto err_0;
-
-  if (lval->type != VARADR_TYPE) {
-    type_err(lval, VARADR_TYPE);
-    goto err_1;
+  if (g_trace.size == g_trace.capacity) {
+    if (!g_trace.wrap) {
+      if (tflush() != 0)
+        goto err_0;
+    }
+    else
+      g_trace.size = 0;
   }
 
-  type_t* rval = spop();
-  if (rval == NULL)
-    goto err_1;
-
-  tcopy(rval, lval->data.varadr);
-
-  tfree(rval);
-  tfree(lval);
-  return last;
-err_1:
-  tfree(lval);
+  record_t* record = g_trace.data+g_trace.size++;
+  record->at = pc->token->at;
+  record->op = pc->op;
+  record->depth = vm->stack.size;
+  if (vm->stack.size > 0) {
+    const type_t* top = vm->stack.data+vm->stack.size-1;
+    record->type = top->type;
+    record->top = top->type == VALUE_TYPE? top->data.value
+      : top->type == VARADR_TYPE? top->data.varadr: top->data.code;
+  }
+  else {
+    record->type = __TYPE_BOUND__;
+    record->top = 0;
+  }
+  g_trace.total++;
+  return 0;
 err_0:
-  return NULL;
+  return -1;
 }
 
-static token_t* do_rval(token_t* first, token_t* last)
+static int tclose()
 {
-  type_t* lval = spop();
-  if (lval == NULL)
-    goto err_0;
-
-  if (lval->type != VARADR_TYPE) {
-    type_err(lval, VARADR_TYPE);
-    goto err_1;
+  if (g_trace.fd < 0)
+    return 0;
+
+  int status = -1;
+  // a wrapped ring holds its oldest record right after the newest one
+  if (g_trace.wrap && g_trace.total > g_trace.capacity) {
+    size_t oldest = g_trace.size;
+    if (twrite(g_trace.data+oldest, (g_trace.capacity-oldest)*sizeof(record_t)) != 0)
+      goto out;
   }
-
-  type_t* rval = tcopy(lval->data.varadr, NULL);
-  if (rval == NULL)
-    goto err_1;
-
-  if (spush(rval) != 0)
-    goto err_2;
-
-  tfree(lval);
-  return last;
-err_2:
-  tfree(rval);
-err_1:
-  tfree(lval);
-err_0:
-  return NULL;
+  if (tflush() != 0)
+    goto out;
+
+  theader_t header;
+  theader(&header);
+  if (pwrite(g_trace.fd, &header, sizeof(header), 0) != sizeof(header)) {
+    err_msg("trace: %s", sys_msg());
+    goto out;
+  }
+  status = 0;
+out:
+  close(g_trace.fd);
+  free(g_trace.data);
+  memset(&g_trace, 0, sizeof(g_trace));
+  g_trace.fd = -1;
+  return status;
 }
 
-static token_t* do_apply(token_t* first, token_t* last)
+static int tdecode(const char* filename)
 {
-  type_t* data = spop();
-  if (data == NULL)
+  FILE* in = fopen(filename, "rb");
+  if (in == NULL) {
+    err_msg("%s: %s", filename, sys_msg());
     goto err_0;
-
-  if (data->type != CODE_TYPE) {
-    type_err(data, CODE_TYPE);
-    goto err_1;
   }
 
-  if (parse(data->data.code.first, data->data.code.last) != 0)
-    goto err_1;
-
-  tfree(data);
-  return last;
-err_1:
-  tfree(data);
-err_0:
-  return NULL;
-}
-
-static token_t* do_binary(token_t* first, token_t* last)
-{
-  type_t* rhs = spop();
-  if (rhs == NULL)
-    goto err_0;
-  
-  if (rhs->type != VALUE_TYPE) {
-    type_err(rhs, VALUE_TYPE);
+  theader_t header;
+  if (fread(&header, sizeof(header), 1, in) != 1
+      || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+    err_msg("%s: not a trace", filename);
     goto err_1;
   }
 
-  type_t* lhs = spop();
-  if (lhs == NULL)
+  if (header.record != sizeof(record_t) || header.ops != __OPCODE_BOUND__) {
+    err_msg("%s: recorded by a different build", filename);
     goto err_1;
-
-  if (lhs->type != VALUE_TYPE) {
-    type_err(lhs, VALUE_TYPE);
-    goto err_2;
   }
 
-  int lhsval = lhs->data.value;
-  int rhsval = rhs->data.value;
-  int lvalval;
-  switch (first->type) {
-    case PLUS: {
-      lvalval = lhsval+rhsval;
-      break;
-    }
-    case MINUS: {
-      lvalval = lhsval-rhsval;
-      break;
-    }
-    case MULTIPLE: {
-      lvalval = lhsval*rhsval;
-      break;
-    }
-    case DIVIDE: {
-      if (rhsval == 0) {
-        err_msg("attempt to divide 0");
-        goto err_2;
-      }
-
-      lvalval = lhsval/rhsval;
-      break;
-    }
-    case ISEQUAL: {
-      lvalval = lhsval == rhsval? TRUE: FALSE;
-      break;
-    }
-    case ISGREATER: {
-      lvalval = lhsval > rhsval? TRUE: FALSE;
-      break;
-    }
-    case AND: {
-      lvalval = lhsval == TRUE && rhsval == TRUE? TRUE: FALSE;
-      break;
-    }
-    case OR: {
-      lvalval = lhsval == TRUE || rhsval == TRUE? TRUE: FALSE;
-      break;
-    }
-    default: {
-      break;
-    }
+  size_t length = strlen(g_program.source.data);
+  if (header.length != length || header.hash != hash(g_program.source.data, length)) {
+    err_msg("%s: recorded from a different source", filename);
+    goto err_1;
   }
 
-  type_t* lval = tnew_value(lvalval);
-  if (lval == NULL)
-    goto err_2;
-
-  if (spush(lval) != 0)
-    goto err_3;
-
-  tfree(lhs);
-  tfree(rhs);
-  return last;
-err_3:
-  tfree(lval);
-err_2:
-  tfree(lhs);
-err_1:
-  tfree(rhs);
-err_0:
-  return NULL;
-}
-
-static token_t* do_unary(token_t* first, token_t* last)
-{
-  type_t* rval = spop();
-  if (rval == NULL)
-    goto err_0;
-
-  if (rval->type != VALUE_TYPE) {
-    type_err(rval, VALUE_TYPE);
+  // a wrapped ring only kept the newest records, number them as the run did
+  struct stat st;
+  if (fstat(fileno(in), &st) != 0) {
+    err_msg("%s: %s", filename, sys_msg());
     goto err_1;
   }
+  uint64_t kept = (st.st_size-sizeof(header))/sizeof(record_t);
+  uint64_t index = header.total > kept? header.total-kept: 0;
+
+  record_t record;
+  for (; fread(&record, sizeof(record), 1, in) == 1; index++) {
+    if (record.at > length || record.op >= __OPCODE_BOUND__) {
+      err_msg("%s: corrupt record %llu", filename, (unsigned long long)index);
+      goto err_1;
+    }
 
-  int rvalval = rval->data.value;
-  switch (first->type) {
-      case NEGATE: {
-        rvalval = -rvalval;
+    const char* at = g_program.source.data+record.at;
+    const char* head;
+    size_t line = lfind(&g_program, at, &head);
+    printf("%10llu %5zu:%-4d %-12s %6u",
+        (unsigned long long)index, line+1, (int)(at-head+1),
+        stropcode(record.op), record.depth);
+    switch (record.type) {
+      case VALUE_TYPE: {
+        printf(" %s %lld\n", strtype(record.type), (long long)record.top);
         break;
       }
-      case NOT: {
-        rvalval = rvalval == FALSE? TRUE: FALSE;
+      case VARADR_TYPE: {
+        printf(" %s %c\n", strtype(record.type), (int)record.top+'a');
+        break;
+      }
+      case CODE_TYPE: {
+        printf(" %s %lld\n", strtype(record.type), (long long)record.top);
         break;
       }
       default: {
+        printf("\n");
         break;
       }
+    }
   }
 
-  type_t* lval = tnew_value(rvalval);
-  if (lval == NULL)
-    goto err_1;
-
-  if (spush(lval) != 0)
-    goto err_2;
-
-  tfree(rval);
-  return last;
-err_2:
-  tfree(lval);
+  fclose(in);
+  return 0;
 err_1:
-  tfree(rval);
+  fclose(in);
 err_0:
-  return NULL;
+  return -1;
 }
 
-static token_t* do_duplicate(token_t* first, token_t* last)
+// the profiler and the tracer may watch the same run
+static int hooks(vm_t* vm, const insn_t* pc)
 {
-  type_t* from = spop();
-  if (from == NULL)
-    goto err_0;
-
-  type_t* to = tcopy(from, NULL);
-  if (to == NULL)
-    goto err_1;
-
-  if (spush(from) != 0 || spush(to) != 0)
-    goto err_2;
-
-  return last;
-err_2:
-  tfree(to);
-err_1:
-  tfree(from);
-err_0:
-  return NULL;
+  if (profhook(vm, pc) != 0 || thook(vm, pc) != 0)
+    return -1;
+  return 0;
 }
 
-static token_t* do_delete(token_t* first, token_t* last)
+// a cache file lives next to its source, or in DIR named by the source hash
+static int cpath(const char* filename, const char* dir, char* path)
 {
-  type_t* old = spop();
-  if (old == NULL)
-    goto err_0;
-
-  tfree(old);
-  return last;
-err_0:
-  return NULL;
+  int n;
+  if (dir) {
+    const char* data = g_program.source.data;
+    n = snprintf(path, PATH_MAX, "%s/%016llx.df%s", dir,
+        (unsigned long long)hash(data, strlen(data)), CACHE_SUFFIX);
+  }
+  else if (strcmp(filename, "-") != 0)
+    n = snprintf(path, PATH_MAX, "%s%s", filename, CACHE_SUFFIX);
+  else
+    return -1;
+  return n < PATH_MAX? 0: -1;
 }
 
-static token_t* do_swap(token_t* first, token_t* last)
+// CACHE_FORMAT folded with every opcode name in enum order
+static uint64_t cformat()
 {
-  type_t* rhs = spop();
-  if (rhs == NULL)
-    goto err_0;
-
-  type_t* lhs = spop();
-  if (lhs == NULL)
-    goto err_1;
-
-  if (spush(rhs) != 0 || spush(lhs) != 0)
-    goto err_2;
-
-  return last;
-err_2:
-  tfree(lhs);
-err_1:
-  tfree(rhs);
-err_0:
-  return NULL;
+  uint64_t h = CACHE_FORMAT;
+  for (int op = 0; op < __OPCODE_BOUND__; op++) {
+    const char* name = stropcode(op);
+    h = (h^hash(name, strlen(name)+1))*0x100000001b3ull;
+  }
+  return h;
 }
 
-static token_t* do_rot(token_t* first, token_t* last)
+static void cheader(cheader_t* header)
 {
-  type_t* rhs = spop();
-  if (rhs == NULL)
-    goto err_0;
-
-  type_t* mhs = spop();
-  if (mhs == NULL)
-    goto err_1;
-
-  type_t* lhs = spop();
-  if (lhs == NULL)
-    goto err_2;
-
-  if (spush(mhs) != 0 || spush(rhs) != 0 || spush(lhs) != 0)
-    goto err_3;
-  return last;
-err_3:
-  tfree(lhs);
-err_2:
-  tfree(mhs);
-err_1:
-  tfree(rhs);
-err_0:
-  return NULL;
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+  header->format = cformat();
+  header->insn = sizeof(insn_t);
+  header->token = sizeof(token_t);
+  header->length = strlen(g_program.source.data);
+  header->hash = hash(g_program.source.data, header->length);
 }
 
-static token_t* do_pick(token_t* first, token_t* last)
+// any mismatch is a miss, the caller compiles from source and rewrites it
+static int cload(const char* path)
 {
-  type_t* index = spop();
-  if (index == NULL)
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
     goto err_0;
 
-  if (index->type != VALUE_TYPE) {
-    type_err(index, VALUE_TYPE);
-    goto err_1;
-  }
-
-  type_t* src = spick(index->data.value);
-  if (src == NULL)
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(cheader_t))
     goto err_1;
 
-  type_t* dest = tcopy(src, NULL);
-  if (src == NULL)
+  // private so the vm can still quicken and patch instructions in place
+  char* map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+  if (map == MAP_FAILED)
     goto err_1;
+  close(fd);
 
-  if (spush(dest) != 0)
+  cheader_t expect;
+  cheader(&expect);
+  const cheader_t* header = (const cheader_t*)map;
+  if (memcmp(header, &expect, offsetof(cheader_t, size)) != 0)
     goto err_2;
 
-  tfree(index);
-  return last;
-err_2:
-  tfree(dest);
-err_1:
-  tfree(index);
-err_0:
-  return NULL;
-}
-
-static token_t* do_if(token_t* first, token_t* last)
-{
-  type_t* rhs = spop();
-  if (rhs == NULL)
-    goto err_0;
-
-  if (rhs->type != CODE_TYPE) {
-    type_err(rhs, CODE_TYPE);
-    goto err_1;
-  }
+  size_t length = st.st_size-sizeof(cheader_t);
+  size_t stride = sizeof(insn_t)+sizeof(token_t);
+  if (header->size == 0 || header->size > length/stride
+      || header->size*stride+header->strings != length
+      || header->sum != hash(map+sizeof(cheader_t), length))
+    goto err_2;
 
-  type_t* lhs = spop();
-  if (lhs == NULL)
-    goto err_1;
+  size_t size = header->size;
+  insn_t* insns = (insn_t*)(map+sizeof(cheader_t));
+  token_t* tokens = (token_t*)(insns+size);
+  char* strings = (char*)(tokens+size);
+  for (size_t i = 0; i < size; i++) {
+    insn_t* insn = insns+i;
+    if (insn->op >= JIT_OP || tokens[i].at > header->length)
+      goto err_2;
 
-  if (lhs->type != VALUE_TYPE) {
-    type_err(lhs, VALUE_TYPE);
-    goto err_2;
+    switch (insn->op) {
+      // the body ends in a RET just before where the CODE jumps to
+      case CODE_OP: {
+        if (insn->arg <= i || insn->arg >= size || insns[insn->arg-1].op != RET_OP)
+          goto err_2;
+        break;
+      }
+      case VARADR_OP:
+      case LOAD_OP:
+      case STORE_OP:
+      case CALLVAR_OP:
+      case TAILCALLVAR_OP: {
+        if (insn->arg < 0 || insn->arg >= VARADDR_SIZE)
+          goto err_2;
+        break;
+      }
+      case QUOTE_OP: {
+        int count;
+        if (insn->arg < 0 || insn->arg%sizeof(int) != 0
+            || insn->arg+sizeof(int) > header->strings)
+          goto err_2;
+        memcpy(&count, strings+insn->arg, sizeof(int));
+        if (count < 0 || insn->arg+sizeof(int)+count > header->strings)
+          goto err_2;
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+    insn->token = tokens+i;
   }
-
-  if (lhs->data.value != FALSE
-      && parse(rhs->data.code.first, rhs->data.code.last) != 0)
+  if (insns[size-1].op != HALT_OP)
     goto err_2;
 
-  tfree(lhs);
-  tfree(rhs);
-  return last;
+  g_program.insns = insns;
+  g_program.size = g_program.capacity = size;
+  g_program.strings.data = strings;
+  g_program.strings.size = g_program.strings.capacity = header->strings;
+  g_program.map = map;
+  g_program.length = st.st_size;
+  return 0;
 err_2:
-  tfree(lhs);
+  munmap(map, st.st_size);
+  return -1;
 err_1:
-  tfree(rhs);
+  close(fd);
 err_0:
-  return NULL;
+  return -1;
 }
 
-static token_t* do_while(token_t* first, token_t* last)
+// written to a temporary and renamed over, readers never see half a file
+static int csave(const char* path)
 {
-  type_t* rhs = spop();
-  if (rhs == NULL)
+  size_t size = g_program.size;
+  size_t length = size*(sizeof(insn_t)+sizeof(token_t))+g_program.strings.size;
+  char* payload = malloc(length);
+  if (payload == NULL) {
+    err_msg(sys_msg());
     goto err_0;
-
-  if (rhs->type != CODE_TYPE) {
-    type_err(rhs, CODE_TYPE);
-    goto err_1;
   }
 
-  type_t* lhs = spop();
-  if (lhs == NULL)
-    goto err_1;
-
-  if (lhs->type != CODE_TYPE) {
-    type_err(lhs, CODE_TYPE);
-    goto err_2;
+  insn_t* insns = (insn_t*)payload;
+  token_t* tokens = (token_t*)(insns+size);
+  memcpy(insns, g_program.insns, size*sizeof(insn_t));
+  for (size_t i = 0; i < size; i++) {
+    insns[i].token = NULL;
+    tokens[i] = *g_program.insns[i].token;
   }
-
-  type_t* benchmark;
-  while (1) {
-    if (parse(lhs->data.code.first, lhs->data.code.last) != 0)
-      goto err_2;
-
-    benchmark = spop();
-    if (benchmark == NULL)
-      goto err_2;
-
-    if (benchmark->type != VALUE_TYPE) {
-      type_err(benchmark, VALUE_TYPE);
-      goto err_3;
-    }
-
-    if (benchmark->data.value == FALSE) {
-      tfree(benchmark);
-      break;
-    }
-
-    if (parse(rhs->data.code.first, rhs->data.code.last) != 0)
-      goto err_3;
-
-    tfree(benchmark);
+  if (g_program.strings.size > 0)
+    memcpy(tokens+size, g_program.strings.data, g_program.strings.size);
+
+  cheader_t header;
+  cheader(&header);
+  header.size = size;
+  header.strings = g_program.strings.size;
+  header.sum = hash(payload, length);
+
+  char temp[PATH_MAX];
+  if (snprintf(temp, sizeof(temp), "%s.XXXXXX", path) >= sizeof(temp)) {
+    err_msg("%s: path too long", path);
+    goto err_1;
   }
 
-  tfree(lhs);
-  tfree(rhs);
-  return last;
-err_3:
-  tfree(benchmark);
-err_2:
-  tfree(lhs);
-err_1:
-  tfree(rhs);
-err_0:
-  return NULL;
-}
-
-static token_t* do_toint(token_t* first, token_t* last)
-{
-  type_t* data = spop();
-  if (data == NULL)
-    goto err_0;
-
-  if (data->type != VALUE_TYPE) {
-    type_err(data, VALUE_TYPE);
+  int fd = mkstemp(temp);
+  if (fd < 0) {
+    err_msg("%s: %s", temp, sys_msg());
     goto err_1;
   }
 
-  printf("%d", data->data.value);
-  tfree(data);
-  return last;
-err_1:
-  tfree(data);
-err_0:
-  return NULL;
-}
-
-static int is_not_quote(token_t* token)
-{
-  return token->type != QUOTE;
-}
-
-static token_t* do_quote(token_t* first, token_t* last)
-{
-  if (last->type != QUOTE) {
-    err_msg("missing close \"");
-    goto err_0;
+  FILE* out = fdopen(fd, "wb");
+  if (out == NULL || fchmod(fd, 0644) != 0) {
+    err_msg("%s: %s", temp, sys_msg());
+    if (out)
+      fclose(out);
+    else
+      close(fd);
+    goto err_2;
   }
 
-  while (first < last) {
-    putchar(first->data[0]);
-    first++;
+  int failed = fwrite(&header, sizeof(header), 1, out) != 1
+    || fwrite(payload, length, 1, out) != 1;
+  if (fclose(out) != 0 || failed) {
+    err_msg("%s: %s", temp, sys_msg());
+    goto err_2;
   }
-  return last+1;
-err_0:
-  return NULL;
-}
-
-static token_t* do_tochar(token_t* first, token_t* last)
-{
-  type_t* data = spop();
-  if (data == NULL)
-    goto err_0;
 
-  if (data->type != VALUE_TYPE) {
-    type_err(data, VALUE_TYPE);
-    goto err_1;
+  if (rename(temp, path) != 0) {
+    err_msg("%s: %s", path, sys_msg());
+    goto err_2;
   }
 
-  printf("%c", data->data.value);
-  tfree(data);
-  return last;
-err_1:
-  tfree(data);
-err_0:
-  return NULL;
-}
-
-static token_t* do_getc(token_t* first, token_t* last)
-{
-  type_t* data = tnew_value(getchar());
-  if (data == NULL)
-    goto err_0;
-
-  if (spush(data) != 0)
-    goto err_1;
-  return last;
+  free(payload);
+  return 0;
+err_2:
+  unlink(temp);
 err_1:
-  tfree(data);
+  free(payload);
 err_0:
-  return NULL;
+  return -1;
 }
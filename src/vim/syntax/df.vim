@@ -5,7 +5,7 @@
 sy keyword Todo TODO XXX FIXME contained
 
 sy match Macro /\w\+:/ contained
-sy match Operator /[-:;!+*\/_=>&|~$%\\@?#.,^]/
+sy match Operator /[-:;!+*\/_=>&|~$%\\@?#.,^ß]/
 sy match Constant /[0-9]\+\|'./
 sy match Identifier /[a-z]/
 
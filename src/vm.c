@@ -0,0 +1,2341 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vm.h"
+
+// misc
+static void verr_msg(const report_t* report, const char* fmt, va_list ap);
+static void eprint(void* user, const char* message);
+static void rinit(report_t* report, const dfalse_config_t* config);
+// tells apart programs compiled at the same address
+static unsigned long g_serial;
+
+// token
+static void set_token(program_t* program, token_t* token, const char* data, const int value);
+
+// output
+static int osend(vm_t* vm, const char* data, size_t size);
+static inline int owrite(vm_t* vm, const char* data, const size_t size);
+static int oputc(vm_t* vm, const int c);
+static int oputint(vm_t* vm, const cell_t value);
+
+// input
+static int ifill(vm_t* vm);
+
+// line table
+static int lpush(program_t* program, const char* head);
+static void lindex(program_t* program);
+static void lfree(program_t* program);
+
+// bytecode
+static insn_t* emit(program_t* program, const opcode_e op, const cell_t arg, token_t* token);
+static int intern(program_t* program, const char* data, const int size);
+static const char* literal(const program_t* program, const int offset, int* size);
+
+// type
+static void type_err(vm_t* vm, const type_t* data, const type_e type);
+static type_t tvalue(const cell_t value);
+static type_t tvaradr(const int varadr);
+static type_t tcode(vm_t* vm, const insn_t* code);
+static void tshow(vm_t* vm, const type_t* self);
+
+// global stack
+static int sreserve(vm_t* vm, const size_t count);
+static int spush(vm_t* vm, const type_t data);
+static int spop(vm_t* vm, type_t* data);
+static int spop_type(vm_t* vm, type_t* data, const type_e type);
+static type_t* spick(vm_t* vm, const cell_t index);
+static type_t* stop(vm_t* vm, const int count);
+
+// return stack
+static frame_t* rpush(vm_t* vm, const frame_e type, insn_t* ret);
+
+// memory
+static cell_t* mcell(vm_t* vm, const cell_t index);
+
+// lexer
+static int lexer(program_t* program, const char* foo, token_t** tokens, size_t* size);
+static int decode(program_t* program, const token_t* token, cell_t* value);
+static int match(program_t* program, token_t* first, token_t* last);
+
+// parser
+typedef int isok_i(token_t*);
+typedef token_t* action_i(program_t*, token_t*, token_t*);
+static token_t* parse_linear(program_t* program, token_t* first, token_t* last, isok_i* isok, action_i* action);
+
+// isok
+static int pass(token_t* token);
+
+// compiler
+static int compile(program_t* program, token_t* first, token_t* last);
+
+// action
+static token_t* do_code(program_t* program, token_t* first, token_t* last);
+static token_t* do_varadr(program_t* program, token_t* first, token_t* last);
+static token_t* do_value(program_t* program, token_t* first, token_t* last);
+static token_t* do_quote(program_t* program, token_t* first, token_t* last);
+static token_t* do_operator(program_t* program, token_t* first, token_t* last);
+static insn_t* do_fuse(program_t* program, const opcode_e op, const cell_t arg, token_t* token);
+static void do_tail(insn_t* insn);
+
+// vm
+#ifdef THREADED_DISPATCH
+#define VM_CASE(op) op##_LABEL
+#define VM_DISPATCH() goto *labels[pc->op]
+#else
+#define VM_CASE(op) case op
+#define VM_DISPATCH() goto dispatch
+#endif
+#define VM_GOTO(expr) \
+  do { \
+    insn_t* next = (expr); \
+    if (next == NULL) \
+      goto err_0; \
+    pc = next; \
+    VM_DISPATCH(); \
+  } while (0)
+#define VM_NEXT(handler) VM_GOTO(handler(vm, pc))
+
+// handler
+static inline insn_t* on_ret(vm_t* vm, insn_t* pc);
+static inline insn_t* on_code(vm_t* vm, insn_t* pc);
+static inline insn_t* on_varadr(vm_t* vm, insn_t* pc);
+static inline insn_t* on_value(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_assign(vm_t* vm, insn_t* pc);
+static inline insn_t* on_rval(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_apply(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_binary(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_unary(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_duplicate(vm_t* vm, insn_t* pc);
+static inline insn_t* on_delete(vm_t* vm, insn_t* pc);
+static inline insn_t* on_swap(vm_t* vm, insn_t* pc);
+static inline insn_t* on_rot(vm_t* vm, insn_t* pc);
+static inline insn_t* on_pick(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_if(vm_t* vm, insn_t* pc);
+static inline insn_t* on_while(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_toint(vm_t* vm, insn_t* pc);
+static inline insn_t* on_quote(vm_t* vm, insn_t* pc);
+static inline insn_t* on_tochar(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_getc(vm_t* vm, insn_t* pc);
+static inline insn_t* on_flush(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_get(vm_t* vm, insn_t* pc);
+static inline insn_t* on_put(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_tailapply(vm_t* vm, insn_t* pc);
+static inline insn_t* on_tailif(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_load(vm_t* vm, insn_t* pc);
+static inline insn_t* on_store(vm_t* vm, insn_t* pc);
+static inline insn_t* on_callvar(vm_t* vm, insn_t* pc);
+static inline insn_t* on_tailcallvar(vm_t* vm, insn_t* pc);
+static inline insn_t* on_addi(vm_t* vm, insn_t* pc);
+static inline insn_t* on_iszero(vm_t* vm, insn_t* pc);
+static inline insn_t* on_dupdup(vm_t* vm, insn_t* pc);
+
+static inline insn_t* on_jit(vm_t* vm, insn_t* pc);
+
+// quickening
+static inline void quicken(insn_t* pc);
+static insn_t* deopt(vm_t* vm, insn_t* pc, const opcode_e op);
+static inline int binary(vm_t* vm, const opcode_e op, const cell_t lhsval, const cell_t rhsval, cell_t* result);
+static inline insn_t* on_qbinary(vm_t* vm, insn_t* pc, const opcode_e op);
+static inline insn_t* on_qcall(vm_t* vm, insn_t* pc, const opcode_e op);
+
+const char* sys_msg()
+{
+  return strerror(errno);
+}
+
+void err_msg(const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  verr_msg(NULL, fmt, ap);
+  va_end(ap);
+}
+
+void rerr_msg(const report_t* report, const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  verr_msg(report, fmt, ap);
+  va_end(ap);
+}
+
+// a failing run flushes what it printed so far, the message lands after it
+void vm_err(vm_t* vm, const char* fmt, ...)
+{
+  oflush(vm);
+
+  va_list ap;
+  va_start(ap, fmt);
+  verr_msg(&vm->report, fmt, ap);
+  va_end(ap);
+}
+
+// the cli reports in red on stderr, a library user gets plain lines
+static void verr_msg(const report_t* report, const char* fmt, va_list ap)
+{
+  if (report == NULL || report->error == NULL) {
+    fprintf(stderr, "\e[31m");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\e[0m\n");
+    return;
+  }
+
+  char message[BUFSIZ];
+  vsnprintf(message, sizeof(message), fmt, ap);
+  report->error(report->user, message);
+}
+
+static void eprint(void* user, const char* message)
+{
+  fprintf(stderr, "%s\n", message);
+}
+
+static void rinit(report_t* report, const dfalse_config_t* config)
+{
+  report->error = eprint;
+  report->user = NULL;
+  if (config != NULL && config->error != NULL) {
+    report->error = config->error;
+    report->user = config->user;
+  }
+}
+
+void vinit(vm_t* vm)
+{
+  memset(vm, 0, sizeof(*vm));
+  vm->rstack.limit = RSTACK_LIMIT;
+  vm->input.fd = STDIN_FILENO;
+}
+
+static int osend(vm_t* vm, const char* data, size_t size)
+{
+  while (size > 0) {
+    ssize_t count = vm->write? vm->write(vm->user, data, size)
+      : write(STDOUT_FILENO, data, size);
+    if (count < 0 && errno == EINTR && vm->write == NULL)
+      continue;
+    // a sink that takes nothing would spin here forever
+    if (count <= 0 || (size_t)count > size) {
+      rerr_msg(&vm->report, count < 0 && vm->write == NULL? sys_msg(): "write failed");
+      goto err_0;
+    }
+    data += count;
+    size -= count;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+int oflush(vm_t* vm)
+{
+  size_t size = vm->output.size;
+  vm->output.size = 0;
+  return osend(vm, vm->output.data, size);
+}
+
+static inline int owrite(vm_t* vm, const char* data, const size_t size)
+{
+  if (size <= OUTPUT_SIZE-vm->output.size) {
+    memcpy(vm->output.data+vm->output.size, data, size);
+    vm->output.size += size;
+    return 0;
+  }
+
+  if (oflush(vm) != 0)
+    goto err_0;
+
+  if (size >= OUTPUT_SIZE)
+    return osend(vm, data, size);
+
+  memcpy(vm->output.data+vm->output.size, data, size);
+  vm->output.size += size;
+  return 0;
+err_0:
+  return -1;
+}
+
+static int oputc(vm_t* vm, const int c)
+{
+  if (vm->output.size == OUTPUT_SIZE && oflush(vm) != 0)
+    goto err_0;
+
+  vm->output.data[vm->output.size++] = c;
+  return 0;
+err_0:
+  return -1;
+}
+
+static int oputint(vm_t* vm, const cell_t value)
+{
+  char foo[24];
+  char* it = foo+sizeof(foo);
+  uint64_t magnitude = value < 0? -(uint64_t)value: (uint64_t)value;
+  do {
+    *--it = '0'+magnitude%10;
+    magnitude /= 10;
+  } while (magnitude);
+  if (value < 0)
+    *--it = '-';
+  return owrite(vm, it, foo+sizeof(foo)-it);
+}
+
+int iopen(vm_t* vm, const char* filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    vm_err(vm, "%s: %s", filename, sys_msg());
+    goto err_0;
+  }
+
+  // regular files are served straight from the page cache, anything else
+  // is read in blocks like stdin
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      vm->input.map = map;
+      vm->input.length = st.st_size;
+      vm->input.it = map;
+      vm->input.end = vm->input.it+st.st_size;
+      vm->input.eof = 1;
+    }
+  }
+
+  vm->input.fd = fd;
+  return 0;
+err_0:
+  return -1;
+}
+
+static int ifill(vm_t* vm)
+{
+  if (vm->input.eof)
+    return 0;
+
+  // about to block, let the user see any prompt first
+  if (oflush(vm) != 0)
+    goto err_0;
+
+  ssize_t count;
+  do
+    count = vm->read? vm->read(vm->user, (char*)vm->input.data, INPUT_SIZE)
+      : read(vm->input.fd, vm->input.data, INPUT_SIZE);
+  while (count < 0 && errno == EINTR && vm->read == NULL);
+  if (count < 0) {
+    vm_err(vm, vm->read? "read failed": sys_msg());
+    goto err_0;
+  }
+
+  vm->input.eof = count == 0;
+  vm->input.it = vm->input.data;
+  vm->input.end = vm->input.data+count;
+  return 0;
+err_0:
+  return -1;
+}
+
+void iclose(vm_t* vm)
+{
+  if (vm->input.map != NULL)
+    munmap(vm->input.map, vm->input.length);
+  if (vm->input.fd != STDIN_FILENO)
+    close(vm->input.fd);
+  vm->input.fd = STDIN_FILENO;
+  vm->input.map = NULL;
+  vm->input.it = vm->input.end = NULL;
+}
+const char* stropcode(const opcode_e op)
+{
+  static const char* strs[__OPCODE_BOUND__+1] = {
+    [HALT_OP] = "halt",
+    [RET_OP] = "ret",
+    [CODE_OP] = "code",
+    [VARADR_OP] = "varadr",
+    [VALUE_OP] = "value",
+    [ASSIGN_OP] = "assign",
+    [RVAL_OP] = "rval",
+    [APPLY_OP] = "apply",
+    [PLUS_OP] = "plus",
+    [MINUS_OP] = "minus",
+    [MULTIPLE_OP] = "multiple",
+    [DIVIDE_OP] = "divide",
+    [ISEQUAL_OP] = "isequal",
+    [ISGREATER_OP] = "isgreater",
+    [AND_OP] = "and",
+    [OR_OP] = "or",
+    [NEGATE_OP] = "negate",
+    [NOT_OP] = "not",
+    [DUPLICATE_OP] = "duplicate",
+    [DELETE_OP] = "delete",
+    [SWAP_OP] = "swap",
+    [ROT_OP] = "rot",
+    [PICK_OP] = "pick",
+    [IF_OP] = "if",
+    [WHILE_OP] = "while",
+    [TOINT_OP] = "toint",
+    [QUOTE_OP] = "quote",
+    [TOCHAR_OP] = "tochar",
+    [GETC_OP] = "getc",
+    [FLUSH_OP] = "flush",
+    [GET_OP] = "get",
+    [PUT_OP] = "put",
+    [TAILAPPLY_OP] = "tailapply",
+    [TAILIF_OP] = "tailif",
+    [LOAD_OP] = "load",
+    [STORE_OP] = "store",
+    [CALLVAR_OP] = "callvar",
+    [TAILCALLVAR_OP] = "tailcallvar",
+    [ADDI_OP] = "addi",
+    [ISZERO_OP] = "iszero",
+    [DUPDUP_OP] = "dupdup",
+    [QPLUS_OP] = "qplus",
+    [QMINUS_OP] = "qminus",
+    [QMULTIPLE_OP] = "qmultiple",
+    [QDIVIDE_OP] = "qdivide",
+    [QISEQUAL_OP] = "qisequal",
+    [QISGREATER_OP] = "qisgreater",
+    [QAND_OP] = "qand",
+    [QOR_OP] = "qor",
+    [QAPPLY_OP] = "qapply",
+    [QIF_OP] = "qif",
+    [QTAILAPPLY_OP] = "qtailapply",
+    [QTAILIF_OP] = "qtailif",
+    [JIT_OP] = "jit",
+    [__OPCODE_BOUND__] = "__OPCODE_UNDEFINE__"
+  };
+  return strs[op < __OPCODE_BOUND__? op: __OPCODE_BOUND__];
+}
+
+const char* strtype(const type_e type)
+{
+  static const char* strs[] = {
+    "varadr",
+    "value",
+    "function",
+    "__TYPE_UNDEFINE__"
+  };
+  return strs[type];
+}
+
+static void type_err(vm_t* vm, const type_t* data, const type_e type)
+{
+  vm_err(vm, "expect %s not %s", strtype(type), strtype(data->type));
+}
+
+static void set_token(program_t* program, token_t* token, const char* data, const int value)
+{
+  token->at = data-program->source.data;
+  token->value = value;
+}
+
+token_e ttype(const program_t* program, const token_t* token)
+{
+  const unsigned char* it = (const unsigned char*)tdata(program, token);
+  if (*it == '\0')
+    return __TOKEN_BOUND__;
+  if (islower(*it))
+    return VARADR;
+  if (isdigit(*it))
+    return VALUE;
+  if (*it == CHARPREDICT)
+    return CHAR;
+  // latin-1 or utf-8 encoded
+  if (*it == FLUSH || (it[0] == 0xc3 && it[1] == 0x9f))
+    return FLUSH;
+  return *it;
+}
+
+const char* tdata(const program_t* program, const token_t* token)
+{
+  return program->source.data+token->at;
+}
+
+size_t tsize(const program_t* program, const token_t* token)
+{
+  const char* it = tdata(program, token);
+  switch (ttype(program, token)) {
+    case VALUE: {
+      size_t size = 0;
+      while (isdigit(it[size]))
+        size++;
+      return size;
+    }
+    case QUOTE: {
+      return token->value+2;
+    }
+    case CHAR: {
+      return it[1]? 2: 1;
+    }
+    case FLUSH: {
+      return (unsigned char)*it == FLUSH? 1: 2;
+    }
+    case __TOKEN_BOUND__: {
+      return 0;
+    }
+    default: {
+      return 1;
+    }
+  }
+}
+
+void token_err(const report_t* report, program_t* program, const token_t* token)
+{
+  const char* data = tdata(program, token);
+  const char* head;
+  size_t line = lfind(program, data, &head);
+  char prefix[BUFSIZ];
+  sprintf(prefix, "%zu:%d:", line+1, (int)(data-head+1));
+  rerr_msg(report, "%s from here", prefix);
+
+  char foo[BUFSIZ];
+  int len = data-head;
+  if (len > sizeof(foo)-2)
+    len = sizeof(foo)-2;
+
+  size_t size = len+tsize(program, token)+1;
+  snprintf(foo, size < sizeof(foo)? size: sizeof(foo), "%s", head);
+  rerr_msg(report, "%s %s", prefix, foo);
+
+  for (int i = 0; i < len; i++)
+    foo[i] = isspace(head[i])? head[i]: ' ';
+  foo[len] = '^';
+  foo[len+1] = '\0';
+  rerr_msg(report, "%s %s", prefix, foo);
+}
+
+static int lpush(program_t* program, const char* head)
+{
+  if (program->lines.size == program->lines.capacity) {
+    size_t capacity = program->lines.capacity? program->lines.capacity*2: BUFSIZ;
+    const char** heads = realloc(program->lines.heads, capacity*sizeof(const char*));
+    if (heads == NULL) {
+      rerr_msg(&program->report, sys_msg());
+      goto err_0;
+    }
+    program->lines.heads = heads;
+    program->lines.capacity = capacity;
+  }
+
+  program->lines.heads[program->lines.size++] = head;
+  return 0;
+err_0:
+  return -1;
+}
+
+// only every LINE_STRIDE-th line head is kept, built on the first lookup
+// or when the library compiles, after which the program is only read
+static void lindex(program_t* program)
+{
+  const char* it = program->source.data;
+  if (lpush(program, it) != 0)
+    return;
+
+  for (size_t line = 0; *it; it++)
+    if (*it == NEWLINE && ++line%LINE_STRIDE == 0 && lpush(program, it+1) != 0)
+      return;
+}
+
+size_t lfind(program_t* program, const char* at, const char** head)
+{
+  if (program->lines.size == 0)
+    lindex(program);
+
+  size_t first = 0;
+  size_t last = program->lines.size;
+  while (last-first > 1) {
+    size_t mid = first+(last-first)/2;
+    if (program->lines.heads[mid] <= at)
+      first = mid;
+    else
+      last = mid;
+  }
+
+  size_t line = first*LINE_STRIDE;
+  const char* it = program->lines.size? program->lines.heads[first]: program->source.data;
+  for (*head = it; it < at; it++)
+    if (*it == NEWLINE) {
+      line++;
+      *head = it+1;
+    }
+  return line;
+}
+
+static void lfree(program_t* program)
+{
+  free(program->lines.heads);
+  program->lines.heads = NULL;
+  program->lines.size = program->lines.capacity = 0;
+}
+
+static insn_t* emit(program_t* program, const opcode_e op, const cell_t arg, token_t* token)
+{
+  if (program->size == program->capacity) {
+    size_t capacity = program->capacity? program->capacity*2: BUFSIZ;
+    insn_t* insns = realloc(program->insns, capacity*sizeof(insn_t));
+    if (insns == NULL) {
+      rerr_msg(&program->report, sys_msg());
+      goto err_0;
+    }
+    program->insns = insns;
+    program->capacity = capacity;
+  }
+
+  insn_t* bud = program->insns+program->size++;
+  bud->op = op;
+  bud->arg = arg;
+  bud->token = token;
+  return bud;
+err_0:
+  return NULL;
+}
+
+// string literals live in one pool, each as its length followed by its bytes
+static int intern(program_t* program, const char* data, const int size)
+{
+  size_t need = (sizeof(int)+size+sizeof(int)-1)/sizeof(int)*sizeof(int);
+  strings_t* strings = &program->strings;
+  if (strings->size+need > INT_MAX) {
+    rerr_msg(&program->report, "too many string literals");
+    goto err_0;
+  }
+
+  if (strings->capacity-strings->size < need) {
+    size_t capacity = strings->capacity? strings->capacity: BUFSIZ;
+    while (capacity-strings->size < need)
+      capacity *= 2;
+    char* bud = realloc(strings->data, capacity);
+    if (bud == NULL) {
+      rerr_msg(&program->report, sys_msg());
+      goto err_0;
+    }
+    strings->data = bud;
+    strings->capacity = capacity;
+  }
+
+  int offset = strings->size;
+  memcpy(strings->data+offset, &size, sizeof(int));
+  memcpy(strings->data+offset+sizeof(int), data, size);
+  strings->size += need;
+  return offset;
+err_0:
+  return -1;
+}
+
+static const char* literal(const program_t* program, const int offset, int* size)
+{
+  const char* it = program->strings.data+offset;
+  memcpy(size, it, sizeof(int));
+  return it+sizeof(int);
+}
+
+int pcompile(program_t* program)
+{
+  size_t size;
+  if (lexer(program, program->source.data, &program->tokens, &size) != 0) {
+    rerr_msg(&program->report, "lexer failed");
+    goto err_0;
+  }
+
+  token_t* tokens = program->tokens;
+  if (compile(program, tokens, tokens+size) != 0
+      || emit(program, HALT_OP, 0, tokens+size) == NULL) {
+    rerr_msg(&program->report, "compile failed");
+    goto err_0;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+// a cached program lives in one mapping, its tokens included
+void pfree(program_t* program)
+{
+  jit_free(program);
+  if (program->map)
+    munmap(program->map, program->length);
+  else {
+    free(program->insns);
+    free(program->strings.data);
+    free(program->tokens);
+  }
+  lfree(program);
+  if (program->source.length)
+    munmap(program->source.data, program->source.length);
+  else
+    free(program->source.data);
+  memset(program, 0, sizeof(*program));
+}
+
+void pdump(program_t* program)
+{
+  for (size_t i = 0; i < program->size; i++) {
+    const insn_t* insn = program->insns+i;
+    const char* head;
+    size_t line = lfind(program, tdata(program, insn->token), &head);
+    int column = tdata(program, insn->token)-head+1;
+    printf("%6zu %5zu:%-4d %s", i, line+1, column, stropcode(insn->op));
+    switch (insn->op) {
+      case VARADR_OP:
+      case LOAD_OP:
+      case STORE_OP:
+      case CALLVAR_OP:
+      case TAILCALLVAR_OP: {
+        printf(" %c", (int)(insn->arg+'a'));
+        break;
+      }
+      case CODE_OP:
+      case VALUE_OP:
+      case ADDI_OP: {
+        printf(" %lld", (long long)insn->arg);
+        break;
+      }
+      case QUOTE_OP: {
+        printf(" %.*s", (int)tsize(program, insn->token), tdata(program, insn->token));
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+    putchar('\n');
+  }
+}
+
+static type_t tvalue(const cell_t value)
+{
+  type_t bud;
+  bud.type = VALUE_TYPE;
+  bud.data.value = value;
+  return bud;
+}
+
+static type_t tvaradr(const int varadr)
+{
+  type_t bud;
+  bud.type = VARADR_TYPE;
+  bud.data.varadr = varadr;
+  return bud;
+}
+
+static type_t tcode(vm_t* vm, const insn_t* code)
+{
+  type_t bud;
+  bud.type = CODE_TYPE;
+  bud.data.code = code-vm->insns;
+  return bud;
+}
+
+static void tshow(vm_t* vm, const type_t* self)
+{
+  const char* type_str = strtype(self->type);
+  switch (self->type) {
+    case VALUE_TYPE: {
+      vm_err(vm, "%s %lld", type_str, (long long)self->data.value);
+      break;
+    }
+    case VARADR_TYPE: {
+      vm_err(vm, "%s %c", type_str, self->data.varadr+'a');
+      break;
+    }
+    case CODE_TYPE: {
+      vm_err(vm, "%s start", type_str);
+      token_err(&vm->report, vm->program, vm->insns[self->data.code].token);
+      vm_err(vm, "%s end", type_str);
+      break;
+    }
+    default: {
+    }
+  }
+}
+
+static int sreserve(vm_t* vm, const size_t count)
+{
+  if (vm->stack.capacity-vm->stack.size < count) {
+    size_t capacity = vm->stack.capacity? vm->stack.capacity: BUFSIZ;
+    while (capacity-vm->stack.size < count)
+      capacity *= 2;
+    type_t* bud = realloc(vm->stack.data, capacity*sizeof(type_t));
+    if (bud == NULL) {
+      vm_err(vm, sys_msg());
+      goto err_0;
+    }
+    vm->stack.data = bud;
+    vm->stack.capacity = capacity;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+static int spush(vm_t* vm, const type_t data)
+{
+  if (vm->stack.size == vm->stack.capacity && sreserve(vm, 1) != 0)
+    goto err_0;
+
+  vm->stack.data[vm->stack.size++] = data;
+  return 0;
+err_0:
+  return -1;
+}
+
+static int spop(vm_t* vm, type_t* data)
+{
+  if (sisempty(vm)) {
+    vm_err(vm, "stack underflow");
+    goto err_0;
+  }
+
+  *data = vm->stack.data[--vm->stack.size];
+  return 0;
+err_0:
+  return -1;
+}
+
+static int spop_type(vm_t* vm, type_t* data, const type_e type)
+{
+  if (spop(vm, data) != 0)
+    goto err_0;
+
+  if (data->type != type) {
+    type_err(vm, data, type);
+    goto err_0;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+int sisempty(vm_t* vm)
+{
+  return vm->stack.size == 0;
+}
+
+void sclear(vm_t* vm)
+{
+  type_t data;
+  while (!sisempty(vm) && spop(vm, &data) == 0) {
+    vm_err(vm, "pop:");
+    tshow(vm, &data);
+  }
+
+  free(vm->stack.data);
+  vm->stack.data = NULL;
+  vm->stack.capacity = 0;
+}
+
+static type_t* spick(vm_t* vm, const cell_t index)
+{
+  if (index < 0 || index >= vm->stack.size) {
+    vm_err(vm, "you pick too deep");
+    goto err_0;
+  }
+  return vm->stack.data+vm->stack.size-1-index;
+err_0:
+  return NULL;
+}
+
+static type_t* stop(vm_t* vm, const int count)
+{
+  if (vm->stack.size < count) {
+    vm_err(vm, "stack underflow");
+    goto err_0;
+  }
+  return vm->stack.data+vm->stack.size-count;
+err_0:
+  return NULL;
+}
+
+static frame_t* rpush(vm_t* vm, const frame_e type, insn_t* ret)
+{
+  if (vm->rstack.size == vm->rstack.capacity) {
+    if (vm->rstack.capacity == vm->rstack.limit) {
+      vm_err(vm, "return stack overflow");
+      goto err_0;
+    }
+
+    size_t capacity = vm->rstack.capacity? vm->rstack.capacity*2: BUFSIZ;
+    if (capacity > vm->rstack.limit)
+      capacity = vm->rstack.limit;
+
+    frame_t* bud = realloc(vm->rstack.data, capacity*sizeof(frame_t));
+    if (bud == NULL) {
+      vm_err(vm, sys_msg());
+      goto err_0;
+    }
+    vm->rstack.data = bud;
+    vm->rstack.capacity = capacity;
+  }
+
+  frame_t* frame = vm->rstack.data+vm->rstack.size++;
+  frame->type = type;
+  frame->ret = ret;
+  return frame;
+err_0:
+  return NULL;
+}
+
+void rclear(vm_t* vm)
+{
+  for (int i = 0; vm->rstack.size > 0; i++) {
+    frame_t* frame = vm->rstack.data+--vm->rstack.size;
+    if (i < RSTACK_TRACE)
+      token_err(&vm->report, vm->program, frame->ret[-1].token);
+    else if (i == RSTACK_TRACE)
+      vm_err(vm, "%zu more frames", vm->rstack.size+1);
+  }
+
+  free(vm->rstack.data);
+  vm->rstack.data = NULL;
+  vm->rstack.capacity = 0;
+}
+
+void varadr_init(vm_t* vm)
+{
+  vm->varadr[0].type = VALUE_TYPE;
+  vm->varadr[0].data.value = 0;
+  for (int i = 1; i < VARADDR_SIZE; i++)
+    vm->varadr[i].type = __TYPE_BOUND__;
+}
+
+int mopen(vm_t* vm, const size_t size)
+{
+  if (size == 0)
+    return 0;
+
+  vm->memory.data = calloc(size, sizeof(cell_t));
+  if (vm->memory.data == NULL) {
+    vm_err(vm, sys_msg());
+    goto err_0;
+  }
+  vm->memory.size = size;
+  return 0;
+err_0:
+  return -1;
+}
+
+static cell_t* mcell(vm_t* vm, const cell_t index)
+{
+  if (index < 0 || index >= vm->memory.size) {
+    vm_err(vm, "memory index %lld out of range", (long long)index);
+    goto err_0;
+  }
+  return vm->memory.data+index;
+err_0:
+  return NULL;
+}
+
+void mfree(vm_t* vm)
+{
+  free(vm->memory.data);
+  vm->memory.data = NULL;
+  vm->memory.size = 0;
+}
+
+static int lexer(program_t* program, const char* foo, token_t** tokens, size_t* size)
+{
+  size_t length = strlen(foo);
+  if (length > INT_MAX) {
+    rerr_msg(&program->report, "source too large");
+    goto err_0;
+  }
+
+  token_t* bud = calloc(length+1, sizeof(token_t));
+  if (bud == NULL) {
+    rerr_msg(&program->report, sys_msg());
+    goto err_0;
+  }
+
+  size_t size_ = 0;
+  while (*foo)
+    if (isspace(*foo))
+      foo++;
+    else if (*foo == LCOMMENT) {
+      set_token(program, bud+size_, foo, 0);
+      int depth = 0;
+      do {
+        if (*foo == LCOMMENT)
+          depth++;
+        else if (*foo == RCOMMENT)
+          depth--;
+        foo++;
+      } while (*foo && depth > 0);
+
+      if (depth > 0) {
+        rerr_msg(&program->report, "missing matched %c", RCOMMENT);
+        token_err(&program->report, program, bud+size_);
+        goto err_1;
+      }
+    }
+    else if (*foo == RCOMMENT) {
+      set_token(program, bud+size_, foo, 0);
+      rerr_msg(&program->report, "missing match %c", LCOMMENT);
+      token_err(&program->report, program, bud+size_);
+      goto err_1;
+    }
+    else if (*foo == QUOTE) {
+      const char* start = foo++;
+      while (*foo && *foo != QUOTE)
+        foo++;
+
+      set_token(program, bud+size_, start, foo-start-1);
+      if (*foo != QUOTE) {
+        rerr_msg(&program->report, "missing close \"");
+        token_err(&program->report, program, bud+size_);
+        goto err_1;
+      }
+      size_++;
+      foo++;
+    }
+    else if (islower(*foo)) {
+      set_token(program, bud+size_++, foo, 0);
+      foo++;
+    }
+    else if (isdigit(*foo)) {
+      set_token(program, bud+size_, foo, 0);
+      cell_t value;
+      if (decode(program, bud+size_++, &value) != 0)
+        goto err_1;
+      while (isdigit(*foo))
+        foo++;
+    }
+    else if (*foo == CHARPREDICT) {
+      set_token(program, bud+size_++, foo, (unsigned char)foo[1]);
+      foo++;
+      if (*foo)
+        foo++;
+    }
+    else {
+      set_token(program, bud+size_++, foo, 0);
+      foo += tsize(program, bud+size_-1);
+    }
+
+  set_token(program, bud+size_, foo, 0);
+  if (match(program, bud, bud+size_) != 0)
+    goto err_1;
+
+  *tokens = bud;
+  *size = size_;
+  return 0;
+err_1:
+  free(bud);
+err_0:
+  return -1;
+}
+
+// the token has no room for a wide literal, it is decoded again on compile
+static int decode(program_t* program, const token_t* token, cell_t* value)
+{
+  if (ttype(program, token) == CHAR) {
+    *value = token->value;
+    return 0;
+  }
+
+  const char* it = tdata(program, token);
+  *value = 0;
+  for (; isdigit(*it); it++) {
+    int digit = *it-'0';
+    if (*value > (CELL_MAX-digit)/10) {
+      rerr_msg(&program->report, "value out of range");
+      token_err(&program->report, program, token);
+      goto err_0;
+    }
+    *value = *value*10+digit;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+// an open [ links to the enclosing one until its ] shows up, then both
+// hold the distance to each other
+static int match(program_t* program, token_t* first, token_t* last)
+{
+  token_t* top = NULL;
+  for (token_t* it = first; it < last; it++)
+    if (ttype(program, it) == LCODE) {
+      it->value = top? it-top: 0;
+      top = it;
+    }
+    else if (ttype(program, it) == RCODE) {
+      if (top == NULL) {
+        rerr_msg(&program->report, "missing match %c", LCODE);
+        token_err(&program->report, program, it);
+        goto err_0;
+      }
+
+      token_t* down = top->value? top-top->value: NULL;
+      top->value = it-top;
+      it->value = top-it;
+      top = down;
+    }
+
+  if (top != NULL) {
+    rerr_msg(&program->report, "missing matched %c", RCODE);
+    token_err(&program->report, program, top);
+    goto err_0;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+static token_t* parse_linear(program_t* program, token_t* first, token_t* last, isok_i* isok, action_i* action)
+{
+  token_t* it = first;
+  while (it < last && isok(it))
+    it++;
+  return action(program, first, it);
+}
+
+static int compile(program_t* program, token_t* first, token_t* last)
+{
+  while (first < last) {
+    token_t* save = first;
+    switch (ttype(program, first)) {
+      case LCODE: {
+        first = do_code(program, first+1, first+first->value);
+        break;
+      }
+      case RCODE: {
+        rerr_msg(&program->report, "missing match [");
+        first = NULL;
+        break;
+      }
+      case VARADR: {
+        first = parse_linear(program, first, first+1, pass, do_varadr);
+        break;
+      }
+      case VALUE:
+      case CHAR: {
+        first = parse_linear(program, first, first+1, pass, do_value);
+        break;
+      }
+      case QUOTE: {
+        first = parse_linear(program, first, first+1, pass, do_quote);
+        break;
+      }
+      case ASSIGN:
+      case RVAL:
+      case APPLY:
+      case PLUS:
+      case MINUS:
+      case MULTIPLE:
+      case DIVIDE:
+      case ISEQUAL:
+      case ISGREATER:
+      case AND:
+      case OR:
+      case NEGATE:
+      case NOT:
+      case DUPLICATE:
+      case DELETE:
+      case SWAP:
+      case ROT:
+      case PICK:
+      case IF:
+      case WHILE:
+      case TOINT:
+      case TOCHAR:
+      case GETC:
+      case FLUSH:
+      case GET:
+      case PUT: {
+        first = parse_linear(program, first, first+1, pass, do_operator);
+        break;
+      }
+      default: {
+        rerr_msg(&program->report, "unknown token");
+        first = NULL;
+      }
+    }
+
+    if (first == NULL) {
+      token_err(&program->report, program, save);
+      goto err_0;
+    }
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+static int pass(token_t* token)
+{
+  return 1;
+}
+
+static token_t* do_code(program_t* program, token_t* first, token_t* last)
+{
+  insn_t* code = emit(program, CODE_OP, 0, first-1);
+  if (code == NULL)
+    goto err_0;
+
+  size_t at = code-program->insns;
+  if (compile(program, first, last) != 0)
+    goto err_0;
+
+  if (program->size > at+1)
+    do_tail(program->insns+program->size-1);
+
+  if (emit(program, RET_OP, 0, last) == NULL)
+    goto err_0;
+
+  program->insns[at].arg = program->size;
+  return last+1;
+err_0:
+  return NULL;
+}
+
+static token_t* do_varadr(program_t* program, token_t* first, token_t* last)
+{
+  if (do_fuse(program, VARADR_OP, tdata(program, first)[0]-'a', first) == NULL)
+    goto err_0;
+  return last;
+err_0:
+  return NULL;
+}
+
+static token_t* do_value(program_t* program, token_t* first, token_t* last)
+{
+  cell_t value;
+  if (decode(program, first, &value) != 0 || do_fuse(program, VALUE_OP, value, first) == NULL)
+    goto err_0;
+  return last;
+err_0:
+  return NULL;
+}
+
+static token_t* do_quote(program_t* program, token_t* first, token_t* last)
+{
+  // an empty literal prints nothing, do not spend an instruction on it
+  if (first->value == 0)
+    return last;
+
+  int offset = intern(program, tdata(program, first)+1, first->value);
+  if (offset < 0 || emit(program, QUOTE_OP, offset, first) == NULL)
+    goto err_0;
+  return last;
+err_0:
+  return NULL;
+}
+
+static token_t* do_operator(program_t* program, token_t* first, token_t* last)
+{
+  static const opcode_e ops[__TOKEN_BOUND__] = {
+    [ASSIGN] = ASSIGN_OP,
+    [RVAL] = RVAL_OP,
+    [APPLY] = APPLY_OP,
+    [PLUS] = PLUS_OP,
+    [MINUS] = MINUS_OP,
+    [MULTIPLE] = MULTIPLE_OP,
+    [DIVIDE] = DIVIDE_OP,
+    [ISEQUAL] = ISEQUAL_OP,
+    [ISGREATER] = ISGREATER_OP,
+    [AND] = AND_OP,
+    [OR] = OR_OP,
+    [NEGATE] = NEGATE_OP,
+    [NOT] = NOT_OP,
+    [DUPLICATE] = DUPLICATE_OP,
+    [DELETE] = DELETE_OP,
+    [SWAP] = SWAP_OP,
+    [ROT] = ROT_OP,
+    [PICK] = PICK_OP,
+    [IF] = IF_OP,
+    [WHILE] = WHILE_OP,
+    [TOINT] = TOINT_OP,
+    [TOCHAR] = TOCHAR_OP,
+    [GETC] = GETC_OP,
+    [FLUSH] = FLUSH_OP,
+    [GET] = GET_OP,
+    [PUT] = PUT_OP,
+  };
+
+  if (do_fuse(program, ops[ttype(program, first)], 0, first) == NULL)
+    goto err_0;
+  return last;
+err_0:
+  return NULL;
+}
+
+static insn_t* do_fuse(program_t* program, const opcode_e op, const cell_t arg, token_t* token)
+{
+  insn_t* last = program->size? program->insns+program->size-1: NULL;
+  if (last == NULL)
+    return emit(program, op, arg, token);
+
+  opcode_e fused = __OPCODE_BOUND__;
+  cell_t fusedarg = last->arg;
+  switch (last->op) {
+    case VARADR_OP: {
+      if (op == RVAL_OP)
+        fused = LOAD_OP;
+      else if (op == ASSIGN_OP)
+        fused = STORE_OP;
+      break;
+    }
+    case LOAD_OP: {
+      if (op == APPLY_OP)
+        fused = CALLVAR_OP;
+      break;
+    }
+    case VALUE_OP: {
+      if (op == PLUS_OP)
+        fused = ADDI_OP;
+      else if (op == MINUS_OP && last->arg != CELL_MIN) {
+        fused = ADDI_OP;
+        fusedarg = -last->arg;
+      }
+      else if (op == NEGATE_OP && last->arg != CELL_MIN) {
+        fused = VALUE_OP;
+        fusedarg = -last->arg;
+      }
+      else if (op == ISEQUAL_OP && last->arg == 0)
+        fused = ISZERO_OP;
+      break;
+    }
+    case DUPLICATE_OP: {
+      if (op == DUPLICATE_OP)
+        fused = DUPDUP_OP;
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  if (fused == __OPCODE_BOUND__)
+    return emit(program, op, arg, token);
+
+  last->op = fused;
+  last->arg = fusedarg;
+  last->token = token;
+  return last;
+}
+
+static void do_tail(insn_t* insn)
+{
+  switch (insn->op) {
+    case APPLY_OP: {
+      insn->op = TAILAPPLY_OP;
+      break;
+    }
+    case IF_OP: {
+      insn->op = TAILIF_OP;
+      break;
+    }
+    case CALLVAR_OP: {
+      insn->op = TAILCALLVAR_OP;
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+int execute(vm_t* vm, insn_t* pc)
+{
+#ifdef THREADED_DISPATCH
+  static void* const direct[__OPCODE_BOUND__] = {
+    [HALT_OP] = &&VM_CASE(HALT_OP),
+    [RET_OP] = &&VM_CASE(RET_OP),
+    [CODE_OP] = &&VM_CASE(CODE_OP),
+    [VARADR_OP] = &&VM_CASE(VARADR_OP),
+    [VALUE_OP] = &&VM_CASE(VALUE_OP),
+    [ASSIGN_OP] = &&VM_CASE(ASSIGN_OP),
+    [RVAL_OP] = &&VM_CASE(RVAL_OP),
+    [APPLY_OP] = &&VM_CASE(APPLY_OP),
+    [PLUS_OP] = &&VM_CASE(PLUS_OP),
+    [MINUS_OP] = &&VM_CASE(MINUS_OP),
+    [MULTIPLE_OP] = &&VM_CASE(MULTIPLE_OP),
+    [DIVIDE_OP] = &&VM_CASE(DIVIDE_OP),
+    [ISEQUAL_OP] = &&VM_CASE(ISEQUAL_OP),
+    [ISGREATER_OP] = &&VM_CASE(ISGREATER_OP),
+    [AND_OP] = &&VM_CASE(AND_OP),
+    [OR_OP] = &&VM_CASE(OR_OP),
+    [NEGATE_OP] = &&VM_CASE(NEGATE_OP),
+    [NOT_OP] = &&VM_CASE(NOT_OP),
+    [DUPLICATE_OP] = &&VM_CASE(DUPLICATE_OP),
+    [DELETE_OP] = &&VM_CASE(DELETE_OP),
+    [SWAP_OP] = &&VM_CASE(SWAP_OP),
+    [ROT_OP] = &&VM_CASE(ROT_OP),
+    [PICK_OP] = &&VM_CASE(PICK_OP),
+    [IF_OP] = &&VM_CASE(IF_OP),
+    [WHILE_OP] = &&VM_CASE(WHILE_OP),
+    [TOINT_OP] = &&VM_CASE(TOINT_OP),
+    [QUOTE_OP] = &&VM_CASE(QUOTE_OP),
+    [TOCHAR_OP] = &&VM_CASE(TOCHAR_OP),
+    [GETC_OP] = &&VM_CASE(GETC_OP),
+    [FLUSH_OP] = &&VM_CASE(FLUSH_OP),
+    [GET_OP] = &&VM_CASE(GET_OP),
+    [PUT_OP] = &&VM_CASE(PUT_OP),
+    [TAILAPPLY_OP] = &&VM_CASE(TAILAPPLY_OP),
+    [TAILIF_OP] = &&VM_CASE(TAILIF_OP),
+    [LOAD_OP] = &&VM_CASE(LOAD_OP),
+    [STORE_OP] = &&VM_CASE(STORE_OP),
+    [CALLVAR_OP] = &&VM_CASE(CALLVAR_OP),
+    [TAILCALLVAR_OP] = &&VM_CASE(TAILCALLVAR_OP),
+    [ADDI_OP] = &&VM_CASE(ADDI_OP),
+    [ISZERO_OP] = &&VM_CASE(ISZERO_OP),
+    [DUPDUP_OP] = &&VM_CASE(DUPDUP_OP),
+    [QPLUS_OP] = &&VM_CASE(QPLUS_OP),
+    [QMINUS_OP] = &&VM_CASE(QMINUS_OP),
+    [QMULTIPLE_OP] = &&VM_CASE(QMULTIPLE_OP),
+    [QDIVIDE_OP] = &&VM_CASE(QDIVIDE_OP),
+    [QISEQUAL_OP] = &&VM_CASE(QISEQUAL_OP),
+    [QISGREATER_OP] = &&VM_CASE(QISGREATER_OP),
+    [QAND_OP] = &&VM_CASE(QAND_OP),
+    [QOR_OP] = &&VM_CASE(QOR_OP),
+    [QAPPLY_OP] = &&VM_CASE(QAPPLY_OP),
+    [QIF_OP] = &&VM_CASE(QIF_OP),
+    [QTAILAPPLY_OP] = &&VM_CASE(QTAILAPPLY_OP),
+    [QTAILIF_OP] = &&VM_CASE(QTAILIF_OP),
+    [JIT_OP] = &&VM_CASE(JIT_OP),
+  };
+  // with a hook installed every opcode detours through it first, so the
+  // plain loop pays nothing for it
+  static void* const hooked[__OPCODE_BOUND__] = {
+    [0 ... __OPCODE_BOUND__-1] = &&VM_CASE(HOOK),
+  };
+  void* const* labels = vm->hook? hooked: direct;
+  VM_DISPATCH();
+VM_CASE(HOOK):
+  if (vm->hook(vm, pc) != 0)
+    goto err_0;
+  goto *direct[pc->op];
+#else
+dispatch:
+  if (vm->hook && vm->hook(vm, pc) != 0)
+    goto err_0;
+  switch (pc->op) {
+#endif
+  VM_CASE(HALT_OP):
+    return 0;
+  VM_CASE(RET_OP):
+    VM_NEXT(on_ret);
+  VM_CASE(CODE_OP):
+    VM_NEXT(on_code);
+  VM_CASE(VARADR_OP):
+    VM_NEXT(on_varadr);
+  VM_CASE(VALUE_OP):
+    VM_NEXT(on_value);
+  VM_CASE(ASSIGN_OP):
+    VM_NEXT(on_assign);
+  VM_CASE(RVAL_OP):
+    VM_NEXT(on_rval);
+  VM_CASE(APPLY_OP):
+    VM_NEXT(on_apply);
+  VM_CASE(PLUS_OP):
+  VM_CASE(MINUS_OP):
+  VM_CASE(MULTIPLE_OP):
+  VM_CASE(DIVIDE_OP):
+  VM_CASE(ISEQUAL_OP):
+  VM_CASE(ISGREATER_OP):
+  VM_CASE(AND_OP):
+  VM_CASE(OR_OP):
+    VM_NEXT(on_binary);
+  VM_CASE(NEGATE_OP):
+  VM_CASE(NOT_OP):
+    VM_NEXT(on_unary);
+  VM_CASE(DUPLICATE_OP):
+    VM_NEXT(on_duplicate);
+  VM_CASE(DELETE_OP):
+    VM_NEXT(on_delete);
+  VM_CASE(SWAP_OP):
+    VM_NEXT(on_swap);
+  VM_CASE(ROT_OP):
+    VM_NEXT(on_rot);
+  VM_CASE(PICK_OP):
+    VM_NEXT(on_pick);
+  VM_CASE(IF_OP):
+    VM_NEXT(on_if);
+  VM_CASE(WHILE_OP):
+    VM_NEXT(on_while);
+  VM_CASE(TOINT_OP):
+    VM_NEXT(on_toint);
+  VM_CASE(QUOTE_OP):
+    VM_NEXT(on_quote);
+  VM_CASE(TOCHAR_OP):
+    VM_NEXT(on_tochar);
+  VM_CASE(GETC_OP):
+    VM_NEXT(on_getc);
+  VM_CASE(FLUSH_OP):
+    VM_NEXT(on_flush);
+  VM_CASE(GET_OP):
+    VM_NEXT(on_get);
+  VM_CASE(PUT_OP):
+    VM_NEXT(on_put);
+  VM_CASE(TAILAPPLY_OP):
+    VM_NEXT(on_tailapply);
+  VM_CASE(TAILIF_OP):
+    VM_NEXT(on_tailif);
+  VM_CASE(LOAD_OP):
+    VM_NEXT(on_load);
+  VM_CASE(STORE_OP):
+    VM_NEXT(on_store);
+  VM_CASE(CALLVAR_OP):
+    VM_NEXT(on_callvar);
+  VM_CASE(TAILCALLVAR_OP):
+    VM_NEXT(on_tailcallvar);
+  VM_CASE(ADDI_OP):
+    VM_NEXT(on_addi);
+  VM_CASE(ISZERO_OP):
+    VM_NEXT(on_iszero);
+  VM_CASE(DUPDUP_OP):
+    VM_NEXT(on_dupdup);
+  VM_CASE(QPLUS_OP):
+    VM_GOTO(on_qbinary(vm, pc, PLUS_OP));
+  VM_CASE(QMINUS_OP):
+    VM_GOTO(on_qbinary(vm, pc, MINUS_OP));
+  VM_CASE(QMULTIPLE_OP):
+    VM_GOTO(on_qbinary(vm, pc, MULTIPLE_OP));
+  VM_CASE(QDIVIDE_OP):
+    VM_GOTO(on_qbinary(vm, pc, DIVIDE_OP));
+  VM_CASE(QISEQUAL_OP):
+    VM_GOTO(on_qbinary(vm, pc, ISEQUAL_OP));
+  VM_CASE(QISGREATER_OP):
+    VM_GOTO(on_qbinary(vm, pc, ISGREATER_OP));
+  VM_CASE(QAND_OP):
+    VM_GOTO(on_qbinary(vm, pc, AND_OP));
+  VM_CASE(QOR_OP):
+    VM_GOTO(on_qbinary(vm, pc, OR_OP));
+  VM_CASE(QAPPLY_OP):
+    VM_GOTO(on_qcall(vm, pc, APPLY_OP));
+  VM_CASE(QIF_OP):
+    VM_GOTO(on_qcall(vm, pc, IF_OP));
+  VM_CASE(QTAILAPPLY_OP):
+    VM_GOTO(on_qcall(vm, pc, TAILAPPLY_OP));
+  VM_CASE(QTAILIF_OP):
+    VM_GOTO(on_qcall(vm, pc, TAILIF_OP));
+  VM_CASE(JIT_OP):
+    VM_NEXT(on_jit);
+#ifndef THREADED_DISPATCH
+  default:
+    vm_err(vm, "unknown opcode");
+    goto err_0;
+  }
+#endif
+err_0:
+  token_err(&vm->report, vm->program, pc->token);
+  rclear(vm);
+  return -1;
+}
+
+static inline insn_t* on_ret(vm_t* vm, insn_t* pc)
+{
+  if (vm->rstack.size == 0) {
+    vm_err(vm, "return stack underflow");
+    goto err_0;
+  }
+
+  frame_t* frame = vm->rstack.data+vm->rstack.size-1;
+  switch (frame->type) {
+    case CALL_FRAME: {
+      vm->rstack.size--;
+      return frame->ret;
+    }
+    case COND_FRAME: {
+      type_t benchmark;
+      if (spop_type(vm, &benchmark, VALUE_TYPE) != 0)
+        goto err_0;
+
+      if (benchmark.data.value == FALSE) {
+        vm->rstack.size--;
+        return frame->ret;
+      }
+
+      frame->type = BODY_FRAME;
+      return frame->body;
+    }
+    case BODY_FRAME: {
+      frame->type = COND_FRAME;
+      return frame->cond;
+    }
+    default: {
+      break;
+    }
+  }
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_code(vm_t* vm, insn_t* pc)
+{
+  if (spush(vm, tcode(vm, pc+1)) != 0)
+    goto err_0;
+  return vm->insns+pc->arg;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_varadr(vm_t* vm, insn_t* pc)
+{
+  if (spush(vm, tvaradr(pc->arg)) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_value(vm_t* vm, insn_t* pc)
+{
+  if (spush(vm, tvalue(pc->arg)) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_assign(vm_t* vm, insn_t* pc)
+{
+  type_t lval;
+  if (spop_type(vm, &lval, VARADR_TYPE) != 0)
+    goto err_0;
+
+  type_t rval;
+  if (spop(vm, &rval) != 0)
+    goto err_0;
+
+  vm->varadr[lval.data.varadr] = rval;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_rval(vm_t* vm, insn_t* pc)
+{
+  type_t lval;
+  if (spop_type(vm, &lval, VARADR_TYPE) != 0)
+    goto err_0;
+
+  if (spush(vm, vm->varadr[lval.data.varadr]) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_apply(vm_t* vm, insn_t* pc)
+{
+  type_t data;
+  if (spop_type(vm, &data, CODE_TYPE) != 0)
+    goto err_0;
+
+  if (rpush(vm, CALL_FRAME, pc+1) == NULL)
+    goto err_0;
+
+  quicken(pc);
+  return vm->insns+data.data.code;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_binary(vm_t* vm, insn_t* pc)
+{
+  type_t rhs;
+  if (spop_type(vm, &rhs, VALUE_TYPE) != 0)
+    goto err_0;
+
+  type_t lhs;
+  if (spop_type(vm, &lhs, VALUE_TYPE) != 0)
+    goto err_0;
+
+  if (pc->op == DIVIDE_OP && rhs.data.value == 0) {
+    vm_err(vm, "attempt to divide 0");
+    goto err_0;
+  }
+
+  cell_t lvalval;
+  if (binary(vm, pc->op, lhs.data.value, rhs.data.value, &lvalval) != 0) {
+    vm_err(vm, "arithmetic overflow");
+    goto err_0;
+  }
+
+  if (spush(vm, tvalue(lvalval)) != 0)
+    goto err_0;
+
+  quicken(pc);
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_unary(vm_t* vm, insn_t* pc)
+{
+  type_t rval;
+  if (spop_type(vm, &rval, VALUE_TYPE) != 0)
+    goto err_0;
+
+  cell_t rvalval = rval.data.value;
+  switch (pc->op) {
+      case NEGATE_OP: {
+        if (__builtin_sub_overflow(0, rvalval, &rvalval) && vm->program->trap) {
+          vm_err(vm, "arithmetic overflow");
+          goto err_0;
+        }
+        break;
+      }
+      case NOT_OP: {
+        rvalval = rvalval == FALSE? TRUE: FALSE;
+        break;
+      }
+      default: {
+        break;
+      }
+  }
+
+  if (spush(vm, tvalue(rvalval)) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_duplicate(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 1);
+  if (top == NULL)
+    goto err_0;
+
+  if (spush(vm, *top) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_delete(vm_t* vm, insn_t* pc)
+{
+  type_t old;
+  if (spop(vm, &old) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_swap(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 2);
+  if (top == NULL)
+    goto err_0;
+
+  type_t lhs = top[0];
+  top[0] = top[1];
+  top[1] = lhs;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_rot(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 3);
+  if (top == NULL)
+    goto err_0;
+
+  type_t lhs = top[0];
+  top[0] = top[1];
+  top[1] = top[2];
+  top[2] = lhs;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_pick(vm_t* vm, insn_t* pc)
+{
+  type_t index;
+  if (spop_type(vm, &index, VALUE_TYPE) != 0)
+    goto err_0;
+
+  type_t* src = spick(vm, index.data.value);
+  if (src == NULL)
+    goto err_0;
+
+  if (spush(vm, *src) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_if(vm_t* vm, insn_t* pc)
+{
+  type_t rhs;
+  if (spop_type(vm, &rhs, CODE_TYPE) != 0)
+    goto err_0;
+
+  type_t lhs;
+  if (spop_type(vm, &lhs, VALUE_TYPE) != 0)
+    goto err_0;
+
+  quicken(pc);
+  if (lhs.data.value == FALSE)
+    return pc+1;
+
+  if (rpush(vm, CALL_FRAME, pc+1) == NULL)
+    goto err_0;
+  return vm->insns+rhs.data.code;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_while(vm_t* vm, insn_t* pc)
+{
+  type_t rhs;
+  if (spop_type(vm, &rhs, CODE_TYPE) != 0)
+    goto err_0;
+
+  type_t lhs;
+  if (spop_type(vm, &lhs, CODE_TYPE) != 0)
+    goto err_0;
+
+  frame_t* frame = rpush(vm, COND_FRAME, pc+1);
+  if (frame == NULL)
+    goto err_0;
+
+  frame->cond = vm->insns+lhs.data.code;
+  frame->body = vm->insns+rhs.data.code;
+  return frame->cond;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_toint(vm_t* vm, insn_t* pc)
+{
+  type_t data;
+  if (spop_type(vm, &data, VALUE_TYPE) != 0)
+    goto err_0;
+
+  if (oputint(vm, data.data.value) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_quote(vm_t* vm, insn_t* pc)
+{
+  int size;
+  const char* data = literal(vm->program, pc->arg, &size);
+  if (owrite(vm, data, size) != 0)
+    return NULL;
+  return pc+1;
+}
+
+static inline insn_t* on_tochar(vm_t* vm, insn_t* pc)
+{
+  type_t data;
+  if (spop_type(vm, &data, VALUE_TYPE) != 0)
+    goto err_0;
+
+  if (oputc(vm, data.data.value) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_getc(vm_t* vm, insn_t* pc)
+{
+  if (vm->input.it == vm->input.end && ifill(vm) != 0)
+    goto err_0;
+
+  int c = vm->input.it == vm->input.end? -1: *vm->input.it++;
+  if (spush(vm, tvalue(c)) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_flush(vm_t* vm, insn_t* pc)
+{
+  if (oflush(vm) != 0)
+    return NULL;
+  return pc+1;
+}
+
+static inline insn_t* on_get(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 1);
+  if (top == NULL)
+    goto err_0;
+
+  if (top->type != VALUE_TYPE) {
+    type_err(vm, top, VALUE_TYPE);
+    goto err_0;
+  }
+
+  cell_t* cell = mcell(vm, top->data.value);
+  if (cell == NULL)
+    goto err_0;
+
+  top->data.value = *cell;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_put(vm_t* vm, insn_t* pc)
+{
+  type_t index;
+  if (spop_type(vm, &index, VALUE_TYPE) != 0)
+    goto err_0;
+
+  type_t rval;
+  if (spop_type(vm, &rval, VALUE_TYPE) != 0)
+    goto err_0;
+
+  cell_t* cell = mcell(vm, index.data.value);
+  if (cell == NULL)
+    goto err_0;
+
+  *cell = rval.data.value;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_tailapply(vm_t* vm, insn_t* pc)
+{
+  type_t data;
+  if (spop_type(vm, &data, CODE_TYPE) != 0)
+    goto err_0;
+
+  quicken(pc);
+  return vm->insns+data.data.code;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_tailif(vm_t* vm, insn_t* pc)
+{
+  type_t rhs;
+  if (spop_type(vm, &rhs, CODE_TYPE) != 0)
+    goto err_0;
+
+  type_t lhs;
+  if (spop_type(vm, &lhs, VALUE_TYPE) != 0)
+    goto err_0;
+
+  quicken(pc);
+  if (lhs.data.value == FALSE)
+    return pc+1;
+  return vm->insns+rhs.data.code;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_load(vm_t* vm, insn_t* pc)
+{
+  if (spush(vm, vm->varadr[pc->arg]) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_store(vm_t* vm, insn_t* pc)
+{
+  type_t rval;
+  if (spop(vm, &rval) != 0)
+    goto err_0;
+
+  vm->varadr[pc->arg] = rval;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_callvar(vm_t* vm, insn_t* pc)
+{
+  const type_t* data = vm->varadr+pc->arg;
+  if (data->type != CODE_TYPE) {
+    type_err(vm, data, CODE_TYPE);
+    goto err_0;
+  }
+
+  if (rpush(vm, CALL_FRAME, pc+1) == NULL)
+    goto err_0;
+  return vm->insns+data->data.code;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_tailcallvar(vm_t* vm, insn_t* pc)
+{
+  const type_t* data = vm->varadr+pc->arg;
+  if (data->type != CODE_TYPE) {
+    type_err(vm, data, CODE_TYPE);
+    goto err_0;
+  }
+  return vm->insns+data->data.code;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_addi(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 1);
+  if (top == NULL)
+    goto err_0;
+
+  if (top->type != VALUE_TYPE) {
+    type_err(vm, top, VALUE_TYPE);
+    goto err_0;
+  }
+
+  cell_t value;
+  if (__builtin_add_overflow(top->data.value, pc->arg, &value) && vm->program->trap) {
+    vm_err(vm, "arithmetic overflow");
+    goto err_0;
+  }
+  top->data.value = value;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_iszero(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 1);
+  if (top == NULL)
+    goto err_0;
+
+  if (top->type != VALUE_TYPE) {
+    type_err(vm, top, VALUE_TYPE);
+    goto err_0;
+  }
+
+  top->data.value = top->data.value == 0? TRUE: FALSE;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_dupdup(vm_t* vm, insn_t* pc)
+{
+  type_t* top = stop(vm, 1);
+  if (top == NULL)
+    goto err_0;
+
+  type_t data = *top;
+  if (spush(vm, data) != 0 || spush(vm, data) != 0)
+    goto err_0;
+  return pc+1;
+err_0:
+  return NULL;
+}
+
+static inline insn_t* on_jit(vm_t* vm, insn_t* pc)
+{
+  const block_t* block = vm->program->jit.blocks+pc->arg;
+  if (vm->stack.size < block->need) {
+    *pc = block->insn;
+    return pc;
+  }
+
+  if (sreserve(vm, block->grow) != 0)
+    goto err_0;
+
+  // the native code exits into the program, this vm runs its own copy
+  insn_t* next = block->native(&vm->stack, vm->varadr, &vm->memory);
+  if (next != NULL)
+    next = vm->insns+(next-vm->program->insns);
+  if (next == pc)
+    *pc = block->insn;
+  return next;
+err_0:
+  return NULL;
+}
+
+static inline void quicken(insn_t* pc)
+{
+  static const opcode_e quick[__OPCODE_BOUND__] = {
+    [PLUS_OP] = QPLUS_OP,
+    [MINUS_OP] = QMINUS_OP,
+    [MULTIPLE_OP] = QMULTIPLE_OP,
+    [DIVIDE_OP] = QDIVIDE_OP,
+    [ISEQUAL_OP] = QISEQUAL_OP,
+    [ISGREATER_OP] = QISGREATER_OP,
+    [AND_OP] = QAND_OP,
+    [OR_OP] = QOR_OP,
+    [APPLY_OP] = QAPPLY_OP,
+    [IF_OP] = QIF_OP,
+    [TAILAPPLY_OP] = QTAILAPPLY_OP,
+    [TAILIF_OP] = QTAILIF_OP,
+  };
+  pc->op = quick[pc->op];
+}
+
+static insn_t* deopt(vm_t* vm, insn_t* pc, const opcode_e op)
+{
+  pc->op = op;
+  switch (op) {
+    case APPLY_OP: {
+      return on_apply(vm, pc);
+    }
+    case IF_OP: {
+      return on_if(vm, pc);
+    }
+    case TAILAPPLY_OP: {
+      return on_tailapply(vm, pc);
+    }
+    case TAILIF_OP: {
+      return on_tailif(vm, pc);
+    }
+    default: {
+      return on_binary(vm, pc);
+    }
+  }
+}
+
+// the result wraps on overflow, which only fails under --trap-overflow
+static inline int binary(vm_t* vm, const opcode_e op, const cell_t lhsval, const cell_t rhsval, cell_t* result)
+{
+  switch (op) {
+    case PLUS_OP: {
+      if (__builtin_add_overflow(lhsval, rhsval, result))
+        goto overflow;
+      return 0;
+    }
+    case MINUS_OP: {
+      if (__builtin_sub_overflow(lhsval, rhsval, result))
+        goto overflow;
+      return 0;
+    }
+    case MULTIPLE_OP: {
+      if (__builtin_mul_overflow(lhsval, rhsval, result))
+        goto overflow;
+      return 0;
+    }
+    case DIVIDE_OP: {
+      // the one quotient that does not fit, it would fault the cpu
+      if (rhsval == -1 && lhsval == CELL_MIN) {
+        *result = CELL_MIN;
+        goto overflow;
+      }
+      *result = lhsval/rhsval;
+      return 0;
+    }
+    case ISEQUAL_OP: {
+      *result = lhsval == rhsval? TRUE: FALSE;
+      return 0;
+    }
+    case ISGREATER_OP: {
+      *result = lhsval > rhsval? TRUE: FALSE;
+      return 0;
+    }
+    case AND_OP: {
+      *result = lhsval == TRUE && rhsval == TRUE? TRUE: FALSE;
+      return 0;
+    }
+    case OR_OP: {
+      *result = lhsval == TRUE || rhsval == TRUE? TRUE: FALSE;
+      return 0;
+    }
+    default: {
+      *result = 0;
+      return 0;
+    }
+  }
+overflow:
+  return vm->program->trap? -1: 0;
+}
+
+static inline insn_t* on_qbinary(vm_t* vm, insn_t* pc, const opcode_e op)
+{
+  if (vm->stack.size < 2)
+    return deopt(vm, pc, op);
+
+  type_t* top = vm->stack.data+vm->stack.size-2;
+  if (top[0].type != VALUE_TYPE || top[1].type != VALUE_TYPE
+      || (op == DIVIDE_OP && top[1].data.value == 0))
+    return deopt(vm, pc, op);
+
+  cell_t value;
+  if (binary(vm, op, top[0].data.value, top[1].data.value, &value) != 0)
+    return deopt(vm, pc, op);
+
+  top[0].data.value = value;
+  vm->stack.size--;
+  return pc+1;
+}
+
+static inline insn_t* on_qcall(vm_t* vm, insn_t* pc, const opcode_e op)
+{
+  int cond = op == IF_OP || op == TAILIF_OP;
+  if (vm->stack.size < 1+cond)
+    return deopt(vm, pc, op);
+
+  type_t* top = vm->stack.data+vm->stack.size-1;
+  if (top[0].type != CODE_TYPE || (cond && top[-1].type != VALUE_TYPE))
+    return deopt(vm, pc, op);
+
+  vm->stack.size -= 1+cond;
+  if (cond && top[-1].data.value == FALSE)
+    return pc+1;
+
+  if ((op == APPLY_OP || op == IF_OP) && rpush(vm, CALL_FRAME, pc+1) == NULL)
+    return NULL;
+  return vm->insns+top[0].data.code;
+}
+
+dfalse_program_t* dfalse_compile(const char* source, size_t length, int flags,
+    const dfalse_config_t* config)
+{
+  report_t report;
+  rinit(&report, config);
+
+  program_t* program = calloc(1, sizeof(program_t));
+  if (program == NULL) {
+    rerr_msg(&report, sys_msg());
+    goto err_0;
+  }
+  program->report = report;
+
+  // the lexer runs up to a NUL, the copy ends with one
+  program->source.data = malloc(length+1);
+  if (program->source.data == NULL) {
+    rerr_msg(&report, sys_msg());
+    goto err_1;
+  }
+  memcpy(program->source.data, source, length);
+  program->source.data[length] = '\0';
+  program->trap = (flags&DFALSE_TRAP_OVERFLOW) != 0;
+
+  if (pcompile(program) != 0)
+    goto err_1;
+  lindex(program);
+  program->serial = __atomic_add_fetch(&g_serial, 1, __ATOMIC_RELAXED);
+
+  if ((flags&DFALSE_JIT) && jit_compile(program) != 0) {
+    rerr_msg(&report, "jit failed");
+    goto err_1;
+  }
+  return program;
+err_1:
+  dfalse_program_free(program);
+err_0:
+  return NULL;
+}
+
+void dfalse_program_free(dfalse_program_t* program)
+{
+  if (program == NULL)
+    return;
+
+  pfree(program);
+  free(program);
+}
+
+dfalse_t* dfalse_new(const dfalse_config_t* config)
+{
+  report_t report;
+  rinit(&report, config);
+
+  vm_t* vm = malloc(sizeof(vm_t));
+  if (vm == NULL) {
+    rerr_msg(&report, sys_msg());
+    goto err_0;
+  }
+
+  vinit(vm);
+  vm->report = report;
+  if (config == NULL)
+    return vm;
+
+  vm->read = config->read;
+  vm->write = config->write;
+  vm->user = config->user;
+  if (config->rstack)
+    vm->rstack.limit = config->rstack;
+  if (mopen(vm, config->memory) != 0)
+    goto err_1;
+  return vm;
+err_1:
+  free(vm);
+err_0:
+  return NULL;
+}
+
+int dfalse_run(dfalse_t* vm, dfalse_program_t* program)
+{
+  // quickening and the jit rewrite what runs, so the program is shared
+  // read-only and every vm takes its own copy, kept while it is the same one
+  if (vm->insns == NULL || vm->program != program || vm->serial != program->serial) {
+    insn_t* insns = malloc(program->size*sizeof(insn_t));
+    if (insns == NULL) {
+      vm_err(vm, sys_msg());
+      goto err_0;
+    }
+    memcpy(insns, program->insns, program->size*sizeof(insn_t));
+    free(vm->insns);
+    vm->insns = insns;
+    vm->serial = program->serial;
+  }
+
+  // whatever a failed run left on the stack is dropped, not reported
+  vm->program = program;
+  vm->stack.size = 0;
+  varadr_init(vm);
+  if (vm->read) {
+    vm->input.eof = 0;
+    vm->input.it = vm->input.end = NULL;
+  }
+
+  if (execute(vm, vm->insns) != 0 || oflush(vm) != 0)
+    goto err_0;
+
+  if (!sisempty(vm)) {
+    vm_err(vm, "stack is not empty");
+    goto err_0;
+  }
+  return 0;
+err_0:
+  return -1;
+}
+
+void dfalse_free(dfalse_t* vm)
+{
+  if (vm == NULL)
+    return;
+
+  vm->stack.size = 0;
+  sclear(vm);
+  rclear(vm);
+  iclose(vm);
+  mfree(vm);
+  free(vm->insns);
+  free(vm);
+}
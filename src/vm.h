@@ -0,0 +1,313 @@
+#ifndef DFALSE_VM_H_
+#define DFALSE_VM_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "dfalse.h"
+
+// misc
+typedef struct report_t {
+  dfalse_error_i* error;
+  void* user;
+} report_t;
+const char* sys_msg();
+void err_msg(const char* fmt, ...);
+void rerr_msg(const report_t* report, const char* fmt, ...);
+
+// cell
+#ifndef CELL_BITS
+#define CELL_BITS 32
+#endif
+#if CELL_BITS == 64
+typedef int64_t cell_t;
+#define CELL_MAX INT64_MAX
+#define CELL_MIN INT64_MIN
+#else
+typedef int32_t cell_t;
+#define CELL_MAX INT32_MAX
+#define CELL_MIN INT32_MIN
+#endif
+
+// token
+typedef enum token_e {
+  LCOMMENT = '{',
+  RCOMMENT = '}',
+  LCODE = '[',
+  RCODE = ']',
+  VARADR = 256,
+  VALUE = 257,
+  CHAR = 258,
+  CHARPREDICT = '\'',
+  ASSIGN = ':',
+  RVAL = ';',
+  APPLY = '!',
+  PLUS = '+',
+  MINUS = '-',
+  MULTIPLE = '*',
+  DIVIDE = '/',
+  NEGATE = '_',
+  ISEQUAL = '=',
+  ISGREATER = '>',
+  AND = '&',
+  OR = '|',
+  NOT = '~',
+  DUPLICATE = '$',
+  DELETE = '%',
+  SWAP = '\\',
+  ROT = '@',
+  PICK = 'O',
+  IF = '?',
+  WHILE = '#',
+  TOINT = '.',
+  QUOTE = '"',
+  TOCHAR = ',',
+  GETC = '^',
+  FLUSH = 0xdf,
+  GET = 'G',
+  PUT = 'P',
+  NEWLINE = '\n',
+  __TOKEN_BOUND__ = 300
+} token_e;
+typedef struct token_t {
+  unsigned int at;
+  int value;
+} token_t;
+
+// bytecode
+typedef enum opcode_e {
+  HALT_OP,
+  RET_OP,
+  CODE_OP,
+  VARADR_OP,
+  VALUE_OP,
+  ASSIGN_OP,
+  RVAL_OP,
+  APPLY_OP,
+  PLUS_OP,
+  MINUS_OP,
+  MULTIPLE_OP,
+  DIVIDE_OP,
+  ISEQUAL_OP,
+  ISGREATER_OP,
+  AND_OP,
+  OR_OP,
+  NEGATE_OP,
+  NOT_OP,
+  DUPLICATE_OP,
+  DELETE_OP,
+  SWAP_OP,
+  ROT_OP,
+  PICK_OP,
+  IF_OP,
+  WHILE_OP,
+  TOINT_OP,
+  QUOTE_OP,
+  TOCHAR_OP,
+  GETC_OP,
+  FLUSH_OP,
+  GET_OP,
+  PUT_OP,
+  TAILAPPLY_OP,
+  TAILIF_OP,
+  LOAD_OP,
+  STORE_OP,
+  CALLVAR_OP,
+  TAILCALLVAR_OP,
+  ADDI_OP,
+  ISZERO_OP,
+  DUPDUP_OP,
+  QPLUS_OP,
+  QMINUS_OP,
+  QMULTIPLE_OP,
+  QDIVIDE_OP,
+  QISEQUAL_OP,
+  QISGREATER_OP,
+  QAND_OP,
+  QOR_OP,
+  QAPPLY_OP,
+  QIF_OP,
+  QTAILAPPLY_OP,
+  QTAILIF_OP,
+  JIT_OP,
+  __OPCODE_BOUND__
+} opcode_e;
+typedef struct insn_t {
+  opcode_e op;
+  cell_t arg;
+  token_t* token;
+} insn_t;
+typedef struct strings_t {
+  char* data;
+  size_t size;
+  size_t capacity;
+} strings_t;
+typedef struct source_t {
+  char* data;
+  size_t length;
+} source_t;
+typedef struct lines_t {
+  const char** heads;
+  size_t size;
+  size_t capacity;
+} lines_t;
+#define LINE_STRIDE 64
+typedef struct block_t block_t;
+typedef struct jit_t {
+  block_t* blocks;
+  size_t size;
+  size_t capacity;
+  unsigned char* code;
+  size_t length;
+} jit_t;
+typedef struct dfalse_program_t {
+  insn_t* insns;
+  size_t size;
+  size_t capacity;
+  strings_t strings;
+  source_t source;
+  token_t* tokens;
+  lines_t lines;
+  jit_t jit;
+  report_t report;
+  int trap;
+  unsigned long serial;
+  char* map;
+  size_t length;
+} program_t;
+const char* stropcode(const opcode_e op);
+int pcompile(program_t* program);
+void pfree(program_t* program);
+void pdump(program_t* program);
+token_e ttype(const program_t* program, const token_t* token);
+const char* tdata(const program_t* program, const token_t* token);
+size_t tsize(const program_t* program, const token_t* token);
+void token_err(const report_t* report, program_t* program, const token_t* token);
+size_t lfind(program_t* program, const char* at, const char** head);
+
+// type
+typedef enum type_e {
+  VARADR_TYPE,
+  VALUE_TYPE,
+  CODE_TYPE,
+  __TYPE_BOUND__
+} type_e;
+typedef enum boolean_e {
+  TRUE = -1,
+  FALSE = 0,
+  __BOOLEAN_BOUND__
+} boolean_e;
+typedef struct type_t {
+  type_e type;
+  union {
+    cell_t value;
+    int varadr;
+    int code;
+  } data;
+} type_t;
+const char* strtype(const type_e type);
+
+// global stack
+typedef struct stack_t {
+  type_t* data;
+  size_t size;
+  size_t capacity;
+} stack_t;
+
+// return stack
+typedef enum frame_e {
+  CALL_FRAME,
+  COND_FRAME,
+  BODY_FRAME,
+  __FRAME_BOUND__
+} frame_e;
+typedef struct frame_t {
+  frame_e type;
+  insn_t* ret;
+  insn_t* cond;
+  insn_t* body;
+} frame_t;
+typedef struct rstack_t {
+  frame_t* data;
+  size_t size;
+  size_t capacity;
+  size_t limit;
+} rstack_t;
+#define RSTACK_LIMIT (1<<20)
+#define RSTACK_TRACE 16
+
+// heap memory
+typedef struct memory_t {
+  cell_t* data;
+  size_t size;
+} memory_t;
+
+// output
+#define OUTPUT_SIZE (1<<16)
+typedef struct output_t {
+  char data[OUTPUT_SIZE];
+  size_t size;
+} output_t;
+
+// input
+#define INPUT_SIZE (1<<16)
+typedef struct input_t {
+  int fd;
+  int eof;
+  const unsigned char* it;
+  const unsigned char* end;
+  void* map;
+  size_t length;
+  unsigned char data[INPUT_SIZE];
+} input_t;
+
+// vm
+#define VARADDR_SIZE 26
+typedef struct dfalse_t vm_t;
+typedef int hook_i(vm_t* vm, const insn_t* pc);
+struct dfalse_t {
+  program_t* program;
+  // what runs and gets quickened, a copy of the program's when embedded
+  insn_t* insns;
+  unsigned long serial;
+  stack_t stack;
+  rstack_t rstack;
+  type_t varadr[VARADDR_SIZE];
+  memory_t memory;
+  input_t input;
+  output_t output;
+  hook_i* hook;
+  report_t report;
+  dfalse_read_i* read;
+  dfalse_write_i* write;
+  void* user;
+};
+void vinit(vm_t* vm);
+void vm_err(vm_t* vm, const char* fmt, ...);
+int execute(vm_t* vm, insn_t* pc);
+int oflush(vm_t* vm);
+int iopen(vm_t* vm, const char* filename);
+void iclose(vm_t* vm);
+int sisempty(vm_t* vm);
+void sclear(vm_t* vm);
+void rclear(vm_t* vm);
+void varadr_init(vm_t* vm);
+int mopen(vm_t* vm, const size_t size);
+void mfree(vm_t* vm);
+
+// jit
+typedef insn_t* native_i(stack_t* stack, type_t* varadr, memory_t* memory);
+struct block_t {
+  insn_t insn;
+  native_i* native;
+  size_t need;
+  size_t grow;
+};
+int jit_compile(program_t* program);
+void jit_free(program_t* program);
+
+// cgen
+int cgen(const program_t* program, const size_t memory, const size_t rstack, FILE* out);
+
+#endif // DFALSE_VM_H_